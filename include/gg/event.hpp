@@ -21,7 +21,7 @@
  *
  * myevents.cpp
  * ------------
- * static gg::SerializableEventDefinition<"foo"_event, int, char> _foo_event;
+ * static GG_SERIALIZABLE_EVENT(_foo_event, "foo", int, char);
  * gg::IEventDefinition<int, char>& foo_event = _foo_event;
  *
  * main.cpp
@@ -32,15 +32,40 @@
  * auto third = event->get(third_tag); // where third_tag's type is gg::IEvent::Tag<2, float>
  * // ..do stuff..
  * thread->sendEvent(event);
+ *
+ * Every event definition registers its type in gg::getEventTypes(), which throws
+ * gg::EventTypeCollision if two different events share a type.
+ * GG_SERIALIZABLE_EVENT and GG_LOCAL_EVENT pass the name to the definition, which
+ * is the only way to detect events of the same parameters whose names hash to the
+ * same type. Unnamed definitions like the one below can't detect such collisions:
+ *
+ * static gg::SerializableEventDefinition<"foo"_event, int, char> _foo_event;
+ *
+ * Event definitions allocate events from a pool (see gg::PoolAllocator), the
+ * event and its reference counter share a single block.
  */
 
 #pragma once
 
+#include <cassert>
 #include <cstdint>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include "gg/poolallocator.hpp"
 #include "gg/serializable.hpp"
 #include "gg/storage.hpp"
 
+// the event type registry lives in ggthread, but the header is shared with the other
+// libraries, so it can't use their GG_API
+#if defined GGTHREAD_BUILD
+#	define GG_THREAD_API __declspec(dllexport)
+#else
+#	define GG_THREAD_API __declspec(dllimport)
+#endif
+
 namespace gg
 {
 	class IEventDefinitionBase;
@@ -110,33 +135,28 @@ namespace gg
 		virtual EventPtr operator()(IStream&) const = 0;
 		virtual EventPtr operator()(Params... params) const = 0;
 
-		template<unsigned N, class R = Param<N, Params...>::Type>
-		static const R& get(EventPtr event)
+		// the event must have been created by a definition with the same parameters,
+		// it's only checked in debug builds
+		template<unsigned N>
+		static const typename Storage<Params...>::template Type<N>& get(const EventPtr& event)
 		{
-			return event->get<R>(N);
+			return getStorage(event).template get<N>();
 		}
 
 		template<class Tag>
-		static const typename Tag::Type& get(EventPtr event)
+		static const typename Tag::Type& get(const EventPtr& event)
 		{
-			return event->get(Tag {});
+			static_assert(std::is_same<typename Tag::Type, typename Storage<Params...>::template Type<Tag::Param>>::value,
+				"tag type doesn't match the parameter type");
+			return getStorage(event).template get<Tag::Param>();
 		}
 
 	private:
-		template<int N, class... T>
-		struct Param;
-
-		template<class T0, class... T>
-		struct Param<0, T0, T...>
+		static const Storage<Params...>& getStorage(const EventPtr& event)
 		{
-			typedef T0 Type;
-		};
-
-		template<int N, class T0, class... T>
-		struct Param<N, T0, T...>
-		{
-			typedef typename Param<N - 1, T...>::Type Type;
-		};
+			assert(dynamic_cast<const Storage<Params...>*>(&event->getParams()) != nullptr);
+			return static_cast<const Storage<Params...>&>(event->getParams());
+		}
 	};
 
 	inline bool IEvent::is(const IEventDefinitionBase& def) const
@@ -144,6 +164,33 @@ namespace gg
 		return (getType() == def.getType());
 	}
 
+	class EventTypeCollision : public std::logic_error
+	{
+	public:
+		EventTypeCollision(const std::string& what) : std::logic_error(what) {}
+	};
+
+	// assigns dense IDs to event types (from 0, in the order of registration),
+	// so per-type data can be stored in flat arrays indexed by the ID
+	class IEventTypeRegistry
+	{
+	public:
+		typedef uint16_t ID;
+		static const ID INVALID_ID = UINT16_MAX;
+
+		virtual ~IEventTypeRegistry() = default;
+		// 'event_class' tells different events apart, 'name' is optional
+		virtual ID registerDefinition(const IEventDefinitionBase&, const std::type_info& event_class, const char* name) = 0;
+		virtual void unregisterDefinition(const IEventDefinitionBase&) = 0;
+		virtual ID getID(IEvent::Type) const = 0; // INVALID_ID if the type isn't registered
+		virtual size_t getCount() const = 0;
+		virtual const IEventDefinitionBase* getDefinition(IEvent::Type) const = 0;
+	};
+
+	// constructed on first use and never destroyed, so definitions at namespace scope can use it
+	// during static initialization and destruction
+	GG_THREAD_API IEventTypeRegistry& getEventTypes();
+
 	inline namespace literals
 	{
 		constexpr IEvent::Type operator"" _event(const char* evt, size_t)
@@ -160,19 +207,19 @@ namespace gg
 		SerializableStorage() = default;
 		SerializableStorage(Types... values) : Storage(std::forward<Types>(values)...) {}
 		virtual ~SerializableStorage() = default;
-		virtual void serialize(IStream& packet) { serialize<0, Types...>(packet, *this); }
+		virtual void serialize(IStream& packet) { serializeParams<0, Types...>(packet); }
 
 	private:
-		template<size_t N>
-		static void serialize(IStream& packet, IStorage& storage)
+		template<unsigned N>
+		void serializeParams(IStream&)
 		{
 		}
 
-		template<size_t N, class Type0, class... Types>
-		static void serialize(IStream& packet, IStorage& storage)
+		template<unsigned N, class T0, class... Ts>
+		void serializeParams(IStream& packet)
 		{
-			packet & storage.get<Type0>(N);
-			serialize<N + 1, Types...>(packet, storage);
+			packet & this->template get<N>();
+			serializeParams<N + 1, Ts...>(packet);
 		}
 	};
 
@@ -202,6 +249,24 @@ namespace gg
 	public:
 		typedef SerializableEvent<EventType, Params...> Event;
 
+		SerializableEventDefinition()
+		{
+			getEventTypes().registerDefinition(*this, typeid(Event), nullptr);
+		}
+
+		SerializableEventDefinition(const char* name)
+		{
+			if (IEvent::hash(name) != EventType)
+				throw std::invalid_argument(std::string("event type doesn't match the name: ") + name);
+
+			getEventTypes().registerDefinition(*this, typeid(Event), name);
+		}
+
+		virtual ~SerializableEventDefinition()
+		{
+			getEventTypes().unregisterDefinition(*this);
+		}
+
 		virtual IEvent::Type getType() const
 		{
 			return EventType;
@@ -209,14 +274,14 @@ namespace gg
 
 		virtual EventPtr operator()() const
 		{
-			return EventPtr(new Event());
+			return std::allocate_shared<Event>(PoolAllocator<Event>());
 		}
 
 		virtual EventPtr operator()(IStream& ar) const
 		{
 			try
 			{
-				EventPtr event(new Event());
+				EventPtr event = std::allocate_shared<Event>(PoolAllocator<Event>());
 				event->serialize(ar);
 				return event;
 			}
@@ -228,7 +293,7 @@ namespace gg
 
 		virtual EventPtr operator()(Params... params) const
 		{
-			return EventPtr(new Event(std::forward<Params>(params)...));
+			return std::allocate_shared<Event>(PoolAllocator<Event>(), std::forward<Params>(params)...);
 		}
 	};
 
@@ -259,6 +324,24 @@ namespace gg
 	public:
 		typedef LocalEvent<EventType, Params...> Event;
 
+		LocalEventDefinition()
+		{
+			getEventTypes().registerDefinition(*this, typeid(Event), nullptr);
+		}
+
+		LocalEventDefinition(const char* name)
+		{
+			if (IEvent::hash(name) != EventType)
+				throw std::invalid_argument(std::string("event type doesn't match the name: ") + name);
+
+			getEventTypes().registerDefinition(*this, typeid(Event), name);
+		}
+
+		virtual ~LocalEventDefinition()
+		{
+			getEventTypes().unregisterDefinition(*this);
+		}
+
 		virtual IEvent::Type getType() const
 		{
 			return EventType;
@@ -266,7 +349,7 @@ namespace gg
 
 		virtual EventPtr operator()() const
 		{
-			return EventPtr(new Event());
+			return std::allocate_shared<Event>(PoolAllocator<Event>());
 		}
 
 		virtual EventPtr operator()(IStream& ar) const
@@ -276,7 +359,11 @@ namespace gg
 
 		virtual EventPtr operator()(Params... params) const
 		{
-			return EventPtr(new Event(std::forward<Params>(params)...));
+			return std::allocate_shared<Event>(PoolAllocator<Event>(), std::forward<Params>(params)...);
 		}
 	};
 };
+
+// defines a named event definition, e.g. GG_LOCAL_EVENT(foo_event, "foo", int, char);
+#define GG_SERIALIZABLE_EVENT(var, name, ...) gg::SerializableEventDefinition<gg::IEvent::hash(name), __VA_ARGS__> var(name)
+#define GG_LOCAL_EVENT(var, name, ...) gg::LocalEventDefinition<gg::IEvent::hash(name), __VA_ARGS__> var(name)
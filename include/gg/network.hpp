@@ -16,9 +16,11 @@
 
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <memory>
 #include <string>
 #include <typeinfo>
+#include <vector>
 #include "gg/serializable.hpp"
 #include "gg/event.hpp"
 #include "gg/storage.hpp"
@@ -36,12 +38,14 @@ namespace gg
 	class IConnectionBackend;
 	class IServer;
 	class IServerBackend;
+	class IConnectionReactor;
 
 	typedef std::shared_ptr<IPacket> PacketPtr;
 	typedef std::shared_ptr<IConnection> ConnectionPtr;
 	typedef std::unique_ptr<IConnectionBackend> ConnectionBackendPtr;
 	typedef std::shared_ptr<IServer> ServerPtr;
 	typedef std::unique_ptr< IServerBackend > ServerBackendPtr;
+	typedef std::shared_ptr<IConnectionReactor> ConnectionReactorPtr;
 
 	class IPacket : public virtual IStream
 	{
@@ -50,8 +54,8 @@ namespace gg
 
 		virtual ~IPacket() = default;
 		virtual Type getType() const = 0;
-		virtual const char* getData() const = 0;
-		virtual size_t getSize() const = 0;
+		virtual const char* getData() const = 0; // packets over 64 KiB are copied into a contiguous buffer first
+		virtual size_t getSize() const = 0; // up to 16 MiB
 
 		/* inherits all IStream functions */
 	};
@@ -88,9 +92,12 @@ namespace gg
 		virtual bool isAlive() const = 0;
 		virtual const std::string& getAddress() const = 0;
 		virtual PacketPtr getNextPacket(uint32_t timeoutMs = 0) = 0; // 0: non-blocking
+		virtual size_t getNextPackets(std::vector<PacketPtr>&, size_t max_packets, uint32_t timeoutMs = 0) = 0; // appends the packets and returns their number
 		virtual PacketPtr createPacket(IPacket::Type) const = 0;
 		virtual PacketPtr createPacket(EventPtr) const = 0;
-		virtual bool send(PacketPtr) = 0;
+		virtual bool send(PacketPtr) = 0; // queued if it can't be written right away, don't change the packet afterwards
+		virtual bool send(const std::vector<PacketPtr>&) = 0; // coalesced into as few writes as possible
+		virtual bool flush(uint32_t timeoutMs = 0) = 0; // true if every queued packet is written, 0: non-blocking
 	};
 
 	class IServerBackend // adaption to external APIs like Steam
@@ -114,6 +121,32 @@ namespace gg
 		virtual void closeConnections() = 0;
 	};
 
+	// waits for all of its connections at once and reads the packets of the ready ones only,
+	// so idle connections don't cost anything. The reactor is driven by poll(), eg. from a task:
+	//
+	// reactor->addEventDefinition(foo_event);
+	// reactor->setEventHandler([thread](ConnectionPtr, const std::vector<EventPtr>& events) { thread->sendEvents(events); });
+	// reactor->addConnection(server->getNextConnection());
+	// ...
+	// reactor->poll(10); // in ITask::onUpdate
+	class IConnectionReactor
+	{
+	public:
+		typedef std::function<void(ConnectionPtr, PacketPtr)> PacketHandler;
+		typedef std::function<void(ConnectionPtr, const std::vector<EventPtr>&)> EventHandler;
+		typedef std::function<void(ConnectionPtr)> DisconnectHandler;
+
+		virtual ~IConnectionReactor() = default;
+		virtual void addConnection(ConnectionPtr) = 0; // connections of external backends are polled one by one
+		virtual void removeConnection(ConnectionPtr) = 0; // also required after disconnecting it manually
+		virtual size_t getConnectionCount() const = 0;
+		virtual void addEventDefinition(const IEventDefinitionBase&) = 0; // packets of its type are delivered as events
+		virtual void setPacketHandler(PacketHandler) = 0; // packets without an event definition
+		virtual void setEventHandler(EventHandler) = 0; // events of a connection are delivered in batches
+		virtual void setDisconnectHandler(DisconnectHandler) = 0; // the connection is already removed
+		virtual size_t poll(uint32_t timeoutMs = 0) = 0; // returns the number of packets received, 0: non-blocking
+	};
+
 	class INetworkException : public std::exception
 	{
 	public:
@@ -129,6 +162,7 @@ namespace gg
 		virtual ConnectionPtr createConnection(ConnectionBackendPtr&&) const = 0;
 		virtual ServerPtr createServer(uint16_t port, bool tcp = true, bool ipv6 = false) const = 0;
 		virtual ServerPtr createServer(ServerBackendPtr&&) const = 0;
+		virtual ConnectionReactorPtr createReactor() const = 0;
 		virtual PacketPtr createPacket(IPacket::Type) const = 0;
 		virtual PacketPtr createPacket(EventPtr) const = 0;
 	};
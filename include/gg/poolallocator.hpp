@@ -0,0 +1,202 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Fixed size block pool for small objects which are created and destroyed
+ * at a high rate (eg. events). Every thread keeps its own free list, so the
+ * common case of allocating and freeing a block doesn't need any locking.
+ * Blocks freed by a thread which doesn't allocate them (eg. the consumer of
+ * an event) are handed back to the allocating threads in batches through a
+ * shared list.
+ *
+ * Memory is never returned to the system, the pool keeps the peak amount of
+ * blocks.
+ *
+ * PoolAllocator can be used with std::allocate_shared, so an object and the
+ * control block of its shared_ptr are allocated as a single pooled block:
+ *
+ * auto ptr = std::allocate_shared<Foo>(gg::PoolAllocator<Foo>(), args...);
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace gg
+{
+	template<size_t Size, size_t Align>
+	class BlockPool
+	{
+	public:
+		static void* allocate()
+		{
+			Local& local = getLocal();
+
+			if (local.head == nullptr)
+				local.refill();
+
+			Block* block = local.head;
+			local.head = block->next;
+			--local.count;
+			return block;
+		}
+
+		static void deallocate(void* ptr)
+		{
+			Local& local = getLocal();
+
+			Block* block = static_cast<Block*>(ptr);
+			block->next = local.head;
+			local.head = block;
+
+			if (++local.count >= 2 * BATCH_SIZE)
+				local.release(BATCH_SIZE);
+		}
+
+	private:
+		struct Block
+		{
+			Block* next;
+		};
+
+		struct Batch
+		{
+			Block* head;
+			size_t count;
+		};
+
+		enum : size_t
+		{
+			BATCH_SIZE = 256,
+			ALIGN = (Align > alignof(Block)) ? Align : alignof(Block),
+			BLOCK_SIZE = ((Size > sizeof(Block) ? Size : sizeof(Block)) + ALIGN - 1) / ALIGN * ALIGN
+		};
+
+		static_assert(Align <= alignof(std::max_align_t), "over-aligned types are not supported");
+
+		struct Shared
+		{
+			std::mutex mutex;
+			std::vector<Batch> batches;
+		};
+
+		struct Local
+		{
+			Block* head = nullptr;
+			size_t count = 0;
+
+			~Local()
+			{
+				// blocks of an exiting thread are adopted by the others
+				if (head)
+					release(count);
+			}
+
+			void refill()
+			{
+				Shared& shared = getShared();
+				{
+					std::lock_guard<decltype(shared.mutex)> guard(shared.mutex);
+					if (!shared.batches.empty())
+					{
+						head = shared.batches.back().head;
+						count = shared.batches.back().count;
+						shared.batches.pop_back();
+						return;
+					}
+				}
+
+				char* chunk = static_cast<char*>(::operator new(BATCH_SIZE * BLOCK_SIZE));
+				for (size_t i = BATCH_SIZE; i > 0; --i)
+				{
+					Block* block = reinterpret_cast<Block*>(chunk + (i - 1) * BLOCK_SIZE);
+					block->next = head;
+					head = block;
+				}
+				count = BATCH_SIZE;
+			}
+
+			void release(size_t n)
+			{
+				Batch batch = { head, n };
+
+				Block* last = head;
+				for (size_t i = 1; i < n; ++i)
+					last = last->next;
+
+				head = last->next;
+				last->next = nullptr;
+				count -= n;
+
+				Shared& shared = getShared();
+				std::lock_guard<decltype(shared.mutex)> guard(shared.mutex);
+				shared.batches.push_back(batch);
+			}
+		};
+
+		static Local& getLocal()
+		{
+			static thread_local Local local;
+			return local;
+		}
+
+		static Shared& getShared()
+		{
+			// never destroyed, threads might still release blocks during static destruction
+			static Shared* shared = new Shared();
+			return *shared;
+		}
+	};
+
+	template<class T>
+	class PoolAllocator
+	{
+	public:
+		typedef T value_type;
+
+		PoolAllocator() = default;
+
+		template<class U>
+		PoolAllocator(const PoolAllocator<U>&)
+		{
+		}
+
+		T* allocate(size_t n)
+		{
+			if (n == 1)
+				return static_cast<T*>(BlockPool<sizeof(T), alignof(T)>::allocate());
+			else
+				return std::allocator<T>().allocate(n);
+		}
+
+		void deallocate(T* ptr, size_t n)
+		{
+			if (n == 1)
+				BlockPool<sizeof(T), alignof(T)>::deallocate(ptr);
+			else
+				std::allocator<T>().deallocate(ptr, n);
+		}
+
+		template<class U>
+		bool operator==(const PoolAllocator<U>&) const
+		{
+			return true;
+		}
+
+		template<class U>
+		bool operator!=(const PoolAllocator<U>&) const
+		{
+			return false;
+		}
+	};
+};
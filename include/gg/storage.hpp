@@ -8,8 +8,12 @@
 
 #pragma once
 
+#include <new>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <typeinfo>
+#include <utility>
 
 namespace gg
 {
@@ -37,18 +41,108 @@ namespace gg
 		}
 	};
 
+	// Computes the offsets of the elements of a Storage at compile time. Every
+	// element is aligned and with 'Reorder' set they are placed by descending
+	// alignment, which needs no padding between them (the size of a type is a
+	// multiple of its alignment). The order of the elements seen through
+	// Storage doesn't change, only their place in the buffer.
+	template<bool Reorder, class... Types>
+	class StorageLayout
+	{
+	private:
+		template<size_t...>
+		struct sum;
+
+		template<size_t size>
+		struct sum<size>
+		{
+			static const size_t value = size;
+		};
+
+		template<size_t size, size_t... sizes>
+		struct sum<size, sizes...>
+		{
+			static const size_t value = size + sum<sizes...>::value;
+		};
+
+		template<size_t...>
+		struct maximum;
+
+		template<size_t size>
+		struct maximum<size>
+		{
+			static const size_t value = size;
+		};
+
+		template<size_t size, size_t... sizes>
+		struct maximum<size, sizes...>
+		{
+			static const size_t value = (size > maximum<sizes...>::value) ? size : maximum<sizes...>::value;
+		};
+
+		template<unsigned N>
+		using Element = typename std::tuple_element<N, std::tuple<Types...>>::type;
+
+		// declaration order: right after the previous element, aligned
+		template<unsigned N, class = void>
+		struct InOrder
+		{
+			static const size_t offset = (InOrder<N - 1>::end + alignof(Element<N>) - 1) / alignof(Element<N>) * alignof(Element<N>);
+			static const size_t end = offset + sizeof(Element<N>);
+		};
+
+		template<class Dummy>
+		struct InOrder<0, Dummy>
+		{
+			static const size_t offset = 0;
+			static const size_t end = sizeof(Element<0>);
+		};
+
+		// descending alignment: after the elements of larger alignment and the
+		// preceding elements of the same alignment
+		template<unsigned N, class Indices>
+		struct Reordered;
+
+		template<unsigned N, size_t... I>
+		struct Reordered<N, std::index_sequence<I...>>
+		{
+			static const size_t offset = sum<0, ((alignof(Element<I>) > alignof(Element<N>) ||
+				(alignof(Element<I>) == alignof(Element<N>) && I < N)) ? sizeof(Element<I>) : 0)...>::value;
+		};
+
+	public:
+		static const unsigned COUNT = sizeof...(Types);
+		static const size_t ALIGN = maximum<alignof(Types)...>::value;
+		static const size_t SIZE = ((Reorder ? sum<sizeof(Types)...>::value : InOrder<COUNT - 1>::end) + ALIGN - 1) / ALIGN * ALIGN;
+
+		template<unsigned N>
+		struct Offset
+		{
+			static const size_t value = Reorder ?
+				Reordered<N, std::make_index_sequence<COUNT>>::offset : InOrder<N>::offset;
+		};
+	};
+
 	template<class... Types>
 	class Storage : public IStorage
 	{
 	public:
+		typedef StorageLayout<true, Types...> Layout;
+
+		template<unsigned N>
+		using Type = typename std::tuple_element<N, std::tuple<Types...>>::type;
+
+		static const unsigned COUNT = sizeof...(Types);
+		static const size_t SIZE = Layout::SIZE; // size of the buffer holding the elements
+
 		Storage()
 		{
-			default_construct<0, 0, Types...>();
+			default_construct<0, Types...>();
 		}
 
 		Storage(Types... values)
 		{
-			construct<0, 0, Types...>(std::forward<Types>(values)...);
+			construct<0, Types...>(std::forward<Types>(values)...);
 		}
 
 		virtual ~Storage()
@@ -64,72 +158,85 @@ namespace gg
 		virtual char* getPtr(unsigned n)
 		{
 			if (n >= COUNT) throw std::out_of_range({});
-			return m_ptrs[n];
+			return getBuffer() + getOffset(n, std::make_index_sequence<COUNT>());
 		}
 
 		virtual const char* getPtr(unsigned n) const
 		{
 			if (n >= COUNT) throw std::out_of_range({});
-			return m_ptrs[n];
+			return getBuffer() + getOffset(n, std::make_index_sequence<COUNT>());
 		}
 
 		virtual const std::type_info& getType(unsigned n) const
 		{
 			if (n >= COUNT) throw std::out_of_range({});
-			return *m_types[n];
+			static const std::type_info* const types[] = { &typeid(Types)... };
+			return *types[n];
+		}
+
+		using IStorage::get;
+
+		// the type and offset of the element are resolved at compile time
+		template<unsigned N>
+		Type<N>& get()
+		{
+			return *reinterpret_cast<Type<N>*>(getBuffer() + Layout::template Offset<N>::value);
+		}
+
+		template<unsigned N>
+		const Type<N>& get() const
+		{
+			return *reinterpret_cast<const Type<N>*>(getBuffer() + Layout::template Offset<N>::value);
 		}
 
 	private:
-		template<unsigned...>
-		struct sum;
+		template<size_t... N>
+		static size_t getOffset(unsigned n, std::index_sequence<N...>)
+		{
+			static const size_t offsets[] = { Layout::template Offset<N>::value... };
+			return offsets[n];
+		}
 
-		template<unsigned size>
-		struct sum<size>
+		char* getBuffer()
 		{
-			enum { value = size };
-		};
+			return reinterpret_cast<char*>(&m_buffer);
+		}
 
-		template<unsigned size, unsigned... sizes>
-		struct sum<size, sizes...>
+		const char* getBuffer() const
 		{
-			enum { value = size + sum<sizes...>::value };
-		};
+			return reinterpret_cast<const char*>(&m_buffer);
+		}
 
-		template<unsigned N, size_t offset>
+		template<unsigned N>
 		void construct() {}
 
-		template<unsigned N, size_t offset, class T0, class... Ts>
+		template<unsigned N, class T0, class... Ts>
 		void construct(T0 t0, Ts... ts)
 		{
-			m_ptrs[N] = reinterpret_cast<char*>(new (m_buffer + offset) T0(std::forward<T0>(t0)));
-			m_types[N] = &typeid(T0);
-			construct<N + 1, offset + sizeof(T0), Ts...>(std::forward<Ts>(ts)...);
+			new (getBuffer() + Layout::template Offset<N>::value) T0(std::forward<T0>(t0));
+			construct<N + 1, Ts...>(std::forward<Ts>(ts)...);
 		}
 
-		template<unsigned N, size_t offset>
+		template<unsigned N>
 		void default_construct() {}
 
-		template<unsigned N, size_t offset, class T0, class... Ts>
+		template<unsigned N, class T0, class... Ts>
 		void default_construct()
 		{
-			m_ptrs[N] = reinterpret_cast<char*>(new (m_buffer + offset) T0());
-			m_types[N] = &typeid(T0);
-			default_construct<N + 1, offset + sizeof(T0), Ts...>();
+			new (getBuffer() + Layout::template Offset<N>::value) T0();
+			default_construct<N + 1, Ts...>();
 		}
 
-		template<size_t offset>
+		template<unsigned N>
 		void destruct() {}
 
-		template<size_t offset, class T0, class... Ts>
+		template<unsigned N, class T0, class... Ts>
 		void destruct()
 		{
-			reinterpret_cast<T0*>(m_buffer + offset)->~T0();
-			destruct<offset + sizeof(T0), Ts...>();
+			reinterpret_cast<T0*>(getBuffer() + Layout::template Offset<N>::value)->~T0();
+			destruct<N + 1, Ts...>();
 		}
 
-		static const unsigned COUNT = sizeof...(Types);
-		char  m_buffer[sum<sizeof(Types)...>::value];
-		char* m_ptrs[COUNT];
-		const std::type_info* m_types[COUNT];
+		typename std::aligned_storage<Layout::SIZE, Layout::ALIGN>::type m_buffer;
 	};
 };
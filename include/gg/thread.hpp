@@ -9,8 +9,14 @@
 #pragma once
 
 #include <cstdint>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include "gg/event.hpp"
 
 #if defined GGTHREAD_BUILD
@@ -23,14 +29,64 @@ namespace gg
 {
 	class IThread;
 	class IThreadPool;
+	class ITaskGroup;
 	class ITask;
 	class ITaskOptions;
+	class ICoroutine;
+	class IEventRecorder;
+	struct ThreadMetrics;
+	struct TaskMetrics;
+
+	template<class T>
+	class Future;
+
+	template<class T>
+	class Promise;
 
 	typedef std::shared_ptr<IThread> ThreadPtr;
 	typedef std::shared_ptr<IThreadPool> ThreadPoolPtr;
+	typedef std::shared_ptr<ITaskGroup> TaskGroupPtr;
 	typedef std::unique_ptr<ITask> TaskPtr;
+	typedef std::function<void(ICoroutine&)> CoroutineFunc;
+	typedef std::shared_ptr<IEventRecorder> EventRecorderPtr;
+
+	// events of a thread are queued in a lane per priority, every iteration dispatches the
+	// urgent events first and at most a quota of normal and bulk events (see IThread::setEventQuota)
+	enum class EventPriority
+	{
+		URGENT, // control events, never deferred
+		NORMAL,
+		BULK, // high volume events which may be spread over several iterations
+		COUNT
+	};
+
+	// what happens to an event sent to a thread whose lane is full (see ThreadOptions::event_queue_limit)
+	enum class EventOverflowPolicy
+	{
+		BLOCK, // the sender waits until the thread makes room (threads sending to each other can deadlock)
+		DROP_OLDEST,
+		DROP_NEWEST,
+		COALESCE // if full, the newest queued event of the same type is replaced, others are dropped
+	};
+
+	// applied when the thread starts running (in LOCAL mode to the calling thread until run() returns,
+	// except stack_size), see ThreadMetrics::options_applied
+	struct ThreadOptions
+	{
+		std::vector<unsigned> cores; // cores the thread may run on (empty: any)
+		int numa_node = -1; // restricts the thread to the cores of a NUMA node (-1: any)
+		int priority = 0; // nice value from -20 (highest) to 19 (lowest)
+		size_t stack_size = 0; // 0: platform default
+
+		// applied when the thread is created, the urgent lane is never limited and a
+		// thread sending events to its own full lane drops them instead of waiting
+		size_t event_queue_limit = 0; // max events queued in the normal and bulk lanes each (0: unlimited)
+		EventOverflowPolicy event_overflow = EventOverflowPolicy::BLOCK;
+	};
 
-	class IThread
+	// threads are always owned by a ThreadPtr, so a continuation (see Future::then) can
+	// keep a weak reference to its thread
+	class IThread : public std::enable_shared_from_this<IThread>
 	{
 	public:
 		typedef uint16_t State;
@@ -45,7 +101,9 @@ namespace gg
 		virtual const std::string& getName() const = 0;
 		virtual State getState() const = 0;
 		virtual void setState(State) = 0;
-		virtual void sendEvent(EventPtr) = 0;
+		virtual void sendEvent(EventPtr, EventPriority = EventPriority::NORMAL) = 0;
+		virtual void sendEvents(const std::vector<EventPtr>&, EventPriority = EventPriority::NORMAL) = 0; // the batch is enqueued at once
+		virtual void sendEventDelayed(EventPtr, uint32_t delay_ms) = 0; // the thread sleeps until it's due
 		virtual void addTask(TaskPtr&&, State = 0) = 0;
 		virtual void finish() = 0; // stops thread
 		virtual void finishTasks() = 0; // thread becomes zombie if there is no task to run in current state
@@ -53,6 +111,15 @@ namespace gg
 		virtual bool run(Mode = Mode::REMOTE) = 0;
 		virtual bool isAlive() const = 0;
 		virtual void join() = 0;
+		virtual ThreadMetrics getMetrics() const = 0;
+		// runs 'func' on the thread in its next iteration (exceptions thrown by it are ignored)
+		virtual void post(std::function<void()> func) = 0;
+		// adds a task which runs 'func' on its own stack, see ICoroutine
+		virtual void addCoroutine(CoroutineFunc func, State = 0, size_t stack_size = 0) = 0;
+		// records the events the thread dispatches from its next iteration (nullptr stops recording)
+		virtual void setEventRecorder(EventRecorderPtr) = 0;
+		// max number of events dispatched from a lane in an iteration (0: unlimited, the urgent lane is always unlimited)
+		virtual void setEventQuota(EventPriority, size_t max_events) = 0;
 
 		template<class Task, State state = 0, class... Params>
 		void addTask(Params... params)
@@ -60,18 +127,38 @@ namespace gg
 			TaskPtr task(new Task(std::forward<Params>(params)...));
 			addTask(std::move(task), state);
 		}
+
+		// runs 'func' on the thread and returns the future of its result, the result can be
+		// handled on the caller's thread without blocking it, eg. in a task:
+		// db->async([] { return query(); }).then(options.getThread(), [](gg::Future<Rows> rows) { ... });
+		template<class F>
+		auto async(F func) -> Future<decltype(func())>;
 	};
 
 	class IThreadPool
 	{
 	public:
 		virtual ~IThreadPool() = default;
-		virtual ThreadPtr createAndAddThread(const std::string& name) = 0;
+		virtual ThreadPtr createAndAddThread(const std::string& name, const ThreadOptions& = {}) = 0;
 		virtual ThreadPtr getThread(const std::string& name) const = 0;
 		virtual void addThread(ThreadPtr) = 0;
 		virtual bool removeThread(const std::string& name) = 0;
 		virtual void removeThreads() = 0;
-		virtual void sendEvent(EventPtr) = 0;
+		// the priority applies to the threads, pool tasks get the events in the order they are sent
+		virtual void sendEvent(EventPtr, EventPriority = EventPriority::NORMAL) = 0;
+		virtual void sendEvents(const std::vector<EventPtr>&, EventPriority = EventPriority::NORMAL) = 0; // the batch is enqueued at once per thread
+
+		// the task gets scheduled on one of the pool's threads and can be stolen by
+		// idle siblings between updates (it only receives events sent to the pool)
+		virtual void addTask(TaskPtr&&) = 0;
+		virtual std::vector<TaskMetrics> getTaskMetrics() const = 0; // metrics of the pool tasks
+
+		template<class Task, class... Params>
+		void addTask(Params... params)
+		{
+			TaskPtr task(new Task(std::forward<Params>(params)...));
+			addTask(std::move(task));
+		}
 
 		ThreadPtr operator[](const std::string& name) const
 		{
@@ -113,15 +200,445 @@ namespace gg
 		virtual void unsubscribe(IEventDefinitionBase&) = 0;
 		virtual uint32_t getElapsedMs() const = 0;
 		virtual void finish() = 0;
+		// by default onUpdate is called in every iteration of the thread, a non-zero
+		// interval lets the thread sleep until the next update is due
+		virtual void setUpdateInterval(uint32_t ms) = 0;
+		// event-driven tasks are only updated after receiving events (or on interval)
+		virtual void setEventDriven(bool) = 0;
+	};
+
+	// a coroutine is a task written as a plain function: it suspends itself while waiting
+	// for something and the thread resumes it once it's ready (without updating it meanwhile)
+	class ICoroutine
+	{
+	public:
+		virtual ~ICoroutine() = default;
+		virtual ITaskOptions& getOptions() = 0;
+		// the type stays subscribed after the first wait, later events of it are queued until waited for
+		virtual EventPtr waitEvent(IEvent::Type) = 0;
+		virtual EventPtr waitEvent(IEventDefinitionBase&) = 0;
+		virtual void sleep(uint32_t ms) = 0;
+		// checks the condition every 'poll_ms' until it gets true, the interval doubles
+		// up to 'max_poll_ms' while the condition stays false (0: fixed interval)
+		virtual void waitUntil(std::function<bool()> condition, uint32_t poll_ms = 1, uint32_t max_poll_ms = 0) = 0;
+
+		// works with anything which has a non-blocking getNextPacket() like gg::IConnection,
+		// an idle connection is polled less often (a gg::IConnectionReactor delivering the
+		// packets as events to waitEvent() needs no polling at all)
+		template<class Connection>
+		auto waitPacket(Connection& connection, uint32_t poll_ms = 1, uint32_t max_poll_ms = 16) -> decltype(connection.getNextPacket(0))
+		{
+			decltype(connection.getNextPacket(0)) packet;
+			waitUntil([&] { return static_cast<bool>(packet = connection.getNextPacket(0)) || !connection.isAlive(); }, poll_ms, max_poll_ms);
+			return packet;
+		}
+	};
+
+	// writes events with their arrival time to a compact binary file, the parameters are
+	// stored by IEvent::serialize (so local events only keep their type and timing)
+	class IEventRecorder
+	{
+	public:
+		virtual ~IEventRecorder() = default;
+		virtual void record(const std::vector<EventPtr>&) = 0; // can be shared by several threads
+		virtual void flush() = 0;
+	};
+
+	struct TaskMetrics
+	{
+		ITask::ID task_id = 0;
+		std::string name; // type of the task
+		uint64_t update_count = 0;
+		uint64_t update_time_us = 0;
+		uint64_t max_update_time_us = 0;
+		uint64_t event_count = 0;
+		uint64_t event_time_us = 0;
+		uint64_t max_event_time_us = 0;
+		uint64_t error_count = 0; // exceptions passed to onError
+	};
+
+	struct ThreadMetrics
+	{
+		uint64_t iterations = 0;
+		uint64_t idle_time_us = 0; // time spent sleeping
+		uint64_t event_count = 0; // events received by the thread
+		uint64_t max_event_queue_depth = 0; // most events processed in a single iteration
+		uint64_t dropped_events = 0; // events lost because a lane was full
+		uint64_t coalesced_events = 0; // queued events replaced by a newer one of the same type
+		bool options_applied = true; // false if the affinity or priority of ThreadOptions couldn't be set
+		std::vector<TaskMetrics> tasks; // running tasks (except pool tasks)
+	};
+
+	// metrics can be dumped to gg::log or gg::console like: gg::log << thread->getMetrics();
+	inline std::ostream& operator<<(std::ostream& os, const TaskMetrics& m)
+	{
+		return os << "task " << m.task_id << " (" << m.name << "): "
+			<< m.update_count << " updates in " << m.update_time_us << " us (max " << m.max_update_time_us << " us), "
+			<< m.event_count << " events in " << m.event_time_us << " us (max " << m.max_event_time_us << " us), "
+			<< m.error_count << " errors";
+	}
+
+	inline std::ostream& operator<<(std::ostream& os, const ThreadMetrics& m)
+	{
+		os << m.iterations << " iterations, " << m.idle_time_us << " us idle, "
+			<< m.event_count << " events (max " << m.max_event_queue_depth << " per iteration), "
+			<< m.dropped_events << " dropped, " << m.coalesced_events << " coalesced";
+
+		if (!m.options_applied)
+			os << ", thread options not applied";
+
+		for (auto& task : m.tasks)
+			os << "\n  " << task;
+
+		return os;
+	}
+
+	template<class T>
+	class FutureResult // value or exception of a finished call
+	{
+	public:
+		void set(T value)
+		{
+			m_value.reset(new T(std::move(value)));
+		}
+
+		void setError(std::exception_ptr error)
+		{
+			m_error = error;
+		}
+
+		T get()
+		{
+			if (m_error)
+				std::rethrow_exception(m_error);
+
+			return std::move(*m_value);
+		}
+
+	private:
+		std::unique_ptr<T> m_value;
+		std::exception_ptr m_error;
+	};
+
+	template<>
+	class FutureResult<void>
+	{
+	public:
+		void set()
+		{
+		}
+
+		void setError(std::exception_ptr error)
+		{
+			m_error = error;
+		}
+
+		void get()
+		{
+			if (m_error)
+				std::rethrow_exception(m_error);
+		}
+
+	private:
+		std::exception_ptr m_error;
+	};
+
+	template<class T>
+	class FutureState // shared by a promise and its futures
+	{
+	public:
+		FutureState() :
+			m_ready(false)
+		{
+		}
+
+		template<class... V>
+		void setValue(V&&... value)
+		{
+			auto result = &m_result;
+			setResult([&] { result->set(std::forward<V>(value)...); });
+		}
+
+		void setError(std::exception_ptr error)
+		{
+			auto result = &m_result;
+			setResult([&] { result->setError(error); });
+		}
+
+		bool isReady() const
+		{
+			std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+			return m_ready;
+		}
+
+		T get()
+		{
+			std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+			if (!m_ready)
+				throw std::logic_error("future is not ready");
+
+			return m_result.get();
+		}
+
+		void setContinuation(ThreadPtr thread, std::function<void()> continuation)
+		{
+			{
+				std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+				if (!m_ready)
+				{
+					m_thread = thread;
+					m_continuation = std::move(continuation);
+					return;
+				}
+			}
+
+			thread->post(std::move(continuation));
+		}
+
+	private:
+		mutable std::mutex m_mutex;
+		FutureResult<T> m_result;
+		bool m_ready;
+		std::weak_ptr<IThread> m_thread;
+		std::function<void()> m_continuation;
+
+		template<class F>
+		void setResult(F set)
+		{
+			std::weak_ptr<IThread> weak_thread;
+			std::function<void()> continuation;
+			{
+				std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+				if (m_ready)
+					throw std::logic_error("promise is already satisfied");
+
+				set();
+				m_ready = true;
+				weak_thread = std::move(m_thread);
+				continuation = std::move(m_continuation);
+			}
+
+			// the continuation is dropped if its thread is already gone
+			ThreadPtr thread = weak_thread.lock();
+			if (continuation && thread)
+				thread->post(std::move(continuation));
+		}
+	};
+
+	template<class T>
+	class Future
+	{
+	public:
+		Future() = default;
+
+		bool isValid() const
+		{
+			return static_cast<bool>(m_state);
+		}
+
+		bool isReady() const
+		{
+			return m_state->isReady();
+		}
+
+		// can be called once, rethrows the exception of the call
+		T get()
+		{
+			return m_state->get();
+		}
+
+		// 'continuation' gets called with the ready future on 'thread',
+		// it's dropped if the thread is destroyed before the result is set
+		template<class F>
+		void then(IThread& thread, F continuation)
+		{
+			auto state = m_state;
+			m_state->setContinuation(thread.shared_from_this(), [state, continuation]() mutable
+			{
+				continuation(Future<T>(state));
+			});
+		}
+
+	private:
+		friend class Promise<T>;
+
+		std::shared_ptr<FutureState<T>> m_state;
+
+		Future(std::shared_ptr<FutureState<T>> state) :
+			m_state(std::move(state))
+		{
+		}
+	};
+
+	template<class T>
+	class Promise
+	{
+	public:
+		Promise() :
+			m_state(std::make_shared<FutureState<T>>())
+		{
+		}
+
+		Future<T> getFuture() const
+		{
+			return Future<T>(m_state);
+		}
+
+		template<class... V>
+		void setValue(V&&... value)
+		{
+			m_state->setValue(std::forward<V>(value)...);
+		}
+
+		void setError(std::exception_ptr error)
+		{
+			m_state->setError(error);
+		}
+
+		// sets the result of 'func' or the exception thrown by it
+		template<class F>
+		void setResultOf(F& func)
+		{
+			try
+			{
+				setValue(func());
+			}
+			catch (...)
+			{
+				setError(std::current_exception());
+			}
+		}
+
+	private:
+		std::shared_ptr<FutureState<T>> m_state;
+	};
+
+	template<>
+	template<class F>
+	void Promise<void>::setResultOf(F& func)
+	{
+		try
+		{
+			func();
+			setValue();
+		}
+		catch (...)
+		{
+			setError(std::current_exception());
+		}
+	}
+
+	template<class F>
+	auto IThread::async(F func) -> Future<decltype(func())>
+	{
+		Promise<decltype(func())> promise;
+		post([promise, func]() mutable { promise.setResultOf(func); });
+		return promise.getFuture();
+	}
+
+	class ITaskGroup // fork/join group of short jobs running on the shared worker threads
+	{
+	public:
+		virtual ~ITaskGroup() = default; // waits for the jobs
+		virtual void run(std::function<void()>) = 0;
+		// runs queued jobs while waiting, rethrows the first exception thrown by a job
+		virtual void wait() = 0;
 	};
 
 	class IThreadManager
 	{
 	public:
 		virtual ~IThreadManager() = default;
-		virtual ThreadPtr createThread(const std::string& name) const = 0;
+		virtual ThreadPtr createThread(const std::string& name, const ThreadOptions& = {}) const = 0;
 		virtual ThreadPoolPtr createThreadPool() const = 0;
 		virtual ThreadPoolPtr getDefaultThreadPool() = 0;
+		virtual TaskGroupPtr createTaskGroup() = 0;
+		virtual unsigned getWorkerCount() const = 0; // shared worker threads (besides the waiting one)
+
+		// returns nullptr if the file can't be created
+		virtual EventRecorderPtr createEventRecorder(const std::string& file) const = 0;
+
+		// the task sends the recorded events to 'target' with their original timing sped up by 'speed'
+		// (0: as fast as possible) and finishes at the end of the recording, events are recreated
+		// by the definition of their type (or the one registered in gg::getEventTypes()) or skipped
+		virtual TaskPtr createEventReplayer(const std::string& file, ThreadPtr target,
+			std::vector<const IEventDefinitionBase*> definitions, double speed = 1.0) const = 0;
+
+		// calls func(i) for each i in [begin, end), 'grain' is the number of indices per job (0: auto)
+		template<class F>
+		void parallelFor(size_t begin, size_t end, F func, size_t grain = 0)
+		{
+			if (begin >= end)
+				return;
+
+			size_t chunk = getChunkSize(end - begin, grain);
+			auto group = createTaskGroup();
+
+			for (size_t first = begin; first < end; first += chunk)
+			{
+				size_t last = (end - first > chunk) ? first + chunk : end;
+				group->run([&func, first, last]
+				{
+					for (size_t i = first; i < last; ++i)
+						func(i);
+				});
+			}
+
+			group->wait();
+		}
+
+		// combines func(i) of each i in [begin, end) with reduce(T, T), 'identity' is the neutral element
+		template<class T, class F, class R>
+		T parallelReduce(size_t begin, size_t end, T identity, F func, R reduce, size_t grain = 0)
+		{
+			if (begin >= end)
+				return identity;
+
+			struct Result
+			{
+				T value;
+				char padding[64]; // keeps the results of the jobs on separate cache lines
+			};
+
+			size_t chunk = getChunkSize(end - begin, grain);
+			std::vector<Result> results((end - begin + chunk - 1) / chunk, Result{ identity, {} });
+			auto group = createTaskGroup();
+
+			for (size_t n = 0; n < results.size(); ++n)
+			{
+				group->run([&, n]
+				{
+					size_t first = begin + n * chunk;
+					size_t last = (end - first > chunk) ? first + chunk : end;
+
+					// the job only touches the shared vector once it's done
+					T result = identity;
+					for (size_t i = first; i < last; ++i)
+						result = reduce(result, func(i));
+
+					results[n].value = std::move(result);
+				});
+			}
+
+			group->wait();
+
+			T result = identity;
+			for (auto& r : results)
+				result = reduce(result, r.value);
+
+			return result;
+		}
+
+	private:
+		size_t getChunkSize(size_t count, size_t grain) const
+		{
+			if (grain)
+				return grain;
+
+			// a few jobs per thread so uneven jobs can be balanced
+			size_t jobs = (getWorkerCount() + 1) * 4;
+			return (count + jobs - 1) / jobs;
+		}
 	};
 
 	extern GG_API IThreadManager& threadmgr;
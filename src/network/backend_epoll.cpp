@@ -0,0 +1,826 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * POSIX backends: sockets are non-blocking, every socket has its own
+ * edge-triggered epoll instance which is only waited on when a call can't
+ * be completed right away (instead of a select() before every call).
+ * An edge is queued as soon as new data (or room for writing) arrives, so
+ * checking the socket first and then waiting can't miss a wakeup.
+ */
+
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "gg/timer.hpp"
+#include "backend_impl.hpp"
+
+static const int SOCKET_ERROR = -1;
+
+
+static uint16_t getPortFromSockaddr(SOCKADDR_STORAGE* sockaddr)
+{
+	switch (sockaddr->ss_family)
+	{
+	case AF_INET:
+		return ntohs(reinterpret_cast<struct sockaddr_in*>(sockaddr)->sin_port);
+	case AF_INET6:
+		return ntohs(reinterpret_cast<struct sockaddr_in6*>(sockaddr)->sin6_port);
+	default:
+		return 0;
+	}
+}
+
+static std::string getHostFromSockaddr(SOCKADDR_STORAGE* sockaddr)
+{
+	char str[NI_MAXHOST];
+	str[0] = '\0';
+	getnameinfo(reinterpret_cast<struct sockaddr*>(sockaddr), sizeof(SOCKADDR_STORAGE),
+		str, sizeof(str), NULL, 0, NI_NUMERICHOST);
+	return str;
+}
+
+static bool setNonBlocking(SOCKET socket)
+{
+	int flags = fcntl(socket, F_GETFL, 0);
+	return (flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+static int createPoller(SOCKET socket)
+{
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll == -1)
+		return -1;
+
+	struct epoll_event event;
+	std::memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.fd = socket;
+
+	if (epoll_ctl(epoll, EPOLL_CTL_ADD, socket, &event) == -1)
+	{
+		close(epoll);
+		return -1;
+	}
+
+	return epoll;
+}
+
+// returns the epoll events of the socket (0: timeout or interrupted), UINT32_MAX: wait forever
+static uint32_t waitForEdge(int epoll, uint32_t timeoutMs)
+{
+	// a negative timeout would wait forever
+	int timeout = (timeoutMs == UINT32_MAX) ? -1 : (timeoutMs > INT_MAX) ? INT_MAX : static_cast<int>(timeoutMs);
+
+	struct epoll_event event;
+	int rc = epoll_wait(epoll, &event, 1, timeout);
+	if (rc == -1)
+		return (errno == EINTR) ? 0u : static_cast<uint32_t>(EPOLLERR);
+
+	return (rc == 0) ? 0u : event.events;
+}
+
+static size_t getAvailableData(SOCKET socket)
+{
+	int bytes_available = 0;
+	ioctl(socket, FIONREAD, &bytes_available);
+	return static_cast<size_t>(bytes_available);
+}
+
+// the remaining time of a timeout is recalculated after every wakeup
+static size_t waitForSocketData(SOCKET socket, int epoll, size_t len, uint32_t timeoutMs, bool& alive)
+{
+	size_t available_bytes = getAvailableData(socket);
+	if (timeoutMs == 0)
+		return available_bytes;
+
+	gg::Timer timer;
+
+	while (available_bytes < len)
+	{
+		uint64_t elapsed = timer.peekElapsed();
+		if (elapsed >= timeoutMs)
+			break;
+
+		uint32_t events = waitForEdge(epoll, static_cast<uint32_t>(timeoutMs - elapsed));
+		if (events & EPOLLERR)
+		{
+			alive = false;
+			return 0;
+		}
+
+		available_bytes = getAvailableData(socket);
+
+		// no more data is coming
+		if (events & (EPOLLRDHUP | EPOLLHUP))
+			break;
+	}
+
+	return available_bytes;
+}
+
+// 0 if there is nothing to read, 'alive' is cleared if the peer closed the connection
+static size_t receive(SOCKET socket, char* ptr, size_t len, int flags, bool stream, bool& alive)
+{
+	for (;;)
+	{
+		ssize_t rc = recv(socket, ptr, len, flags);
+		if (rc > 0)
+			return static_cast<size_t>(rc);
+
+		if (rc == 0)
+		{
+			// an empty datagram is valid, an empty stream read means the peer is gone
+			if (stream && len > 0)
+				alive = false;
+			return 0;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			alive = false;
+
+		return 0;
+	}
+}
+
+// writes everything and waits for room in the socket buffer if necessary (like a blocking socket)
+static size_t transmit(SOCKET socket, int epoll, const char* ptr, size_t len, const SOCKADDR_STORAGE* addr, bool& alive)
+{
+	size_t bytes_written = 0;
+
+	while (bytes_written < len)
+	{
+		ssize_t rc;
+		if (addr)
+			rc = sendto(socket, ptr + bytes_written, len - bytes_written, MSG_NOSIGNAL,
+				reinterpret_cast<const struct sockaddr*>(addr), sizeof(SOCKADDR_STORAGE));
+		else
+			rc = send(socket, ptr + bytes_written, len - bytes_written, MSG_NOSIGNAL);
+
+		if (rc >= 0)
+		{
+			bytes_written += static_cast<size_t>(rc);
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			if (waitForEdge(epoll, UINT32_MAX) & (EPOLLERR | EPOLLHUP))
+			{
+				alive = false;
+				break;
+			}
+		}
+		else if (errno != EINTR)
+		{
+			alive = false;
+			break;
+		}
+	}
+
+	return bytes_written;
+}
+
+// non-blocking, returns the bytes written until the socket buffer got full
+static size_t transmitBuffers(SOCKET socket, const gg::WriteBuffer* buffers, size_t count, bool& alive)
+{
+	struct iovec iov[gg::ISocketBackend::MAX_WRITE_BUFFERS];
+	if (count > gg::ISocketBackend::MAX_WRITE_BUFFERS)
+		count = gg::ISocketBackend::MAX_WRITE_BUFFERS;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		iov[i].iov_base = const_cast<char*>(buffers[i].ptr);
+		iov[i].iov_len = buffers[i].len;
+	}
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	for (;;)
+	{
+		// a single buffer is cheaper to send without importing an iovec
+		ssize_t rc;
+		if (count == 1)
+			rc = send(socket, buffers[0].ptr, buffers[0].len, MSG_NOSIGNAL);
+		else
+			rc = sendmsg(socket, &msg, MSG_NOSIGNAL);
+
+		if (rc >= 0)
+			return static_cast<size_t>(rc);
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			alive = false;
+
+		return 0;
+	}
+}
+
+static void closeSocket(SOCKET& socket, int& epoll)
+{
+	if (epoll != -1)
+	{
+		close(epoll);
+		epoll = -1;
+	}
+
+	if (socket != INVALID_SOCKET)
+	{
+		close(socket);
+		socket = INVALID_SOCKET;
+	}
+}
+
+
+gg::ConnectionBackend::ConnectionBackend(const std::string& host, uint16_t port, bool tcp, bool ipv6) :
+	m_socket(INVALID_SOCKET),
+	m_epoll(-1),
+	m_host(host),
+	m_port(port),
+	m_address(host + ":" + std::to_string(port)),
+	m_tcp(tcp),
+	m_ipv6(ipv6),
+	m_connected(false)
+{
+}
+
+gg::ConnectionBackend::~ConnectionBackend()
+{
+	disconnect();
+}
+
+bool gg::ConnectionBackend::connect(void*)
+{
+	if (m_connected) return false;
+
+	std::string port = std::to_string(m_port);
+	struct addrinfo hints, *result = NULL, *ptr = NULL;
+
+	std::memset(&m_sockaddr, 0, sizeof(SOCKADDR_STORAGE));
+
+	std::memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = m_ipv6 ? AF_INET6 : AF_INET;
+	hints.ai_socktype = m_tcp ? SOCK_STREAM : SOCK_DGRAM;
+	hints.ai_protocol = m_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo(m_host.c_str(), port.c_str(), &hints, &result) != 0)
+	{
+		return false;
+	}
+
+	m_socket = INVALID_SOCKET;
+
+	// attempt to connect to the first possible address in the list returned by getaddrinfo
+	for (ptr = result; ptr != NULL; ptr = ptr->ai_next)
+	{
+		m_socket = socket(ptr->ai_family, ptr->ai_socktype | SOCK_CLOEXEC, ptr->ai_protocol);
+		if (m_socket == INVALID_SOCKET)
+		{
+			continue;
+		}
+
+		// the connection is established in blocking mode, the socket is switched afterwards
+		if (m_tcp)
+		{
+			if (::connect(m_socket, ptr->ai_addr, ptr->ai_addrlen) == SOCKET_ERROR)
+			{
+				close(m_socket);
+				m_socket = INVALID_SOCKET;
+				continue;
+			}
+		}
+		else
+		{
+			std::memcpy(&m_sockaddr, ptr->ai_addr, ptr->ai_addrlen);
+		}
+
+		// everything is OK if we get here
+		break;
+	}
+
+	freeaddrinfo(result);
+
+	if (m_socket == INVALID_SOCKET)
+	{
+		return false;
+	}
+
+	if (!setNonBlocking(m_socket) || (m_epoll = createPoller(m_socket)) == -1)
+	{
+		closeSocket(m_socket, m_epoll);
+		return false;
+	}
+
+	m_connected = true;
+	return true;
+}
+
+void gg::ConnectionBackend::disconnect()
+{
+	if (m_connected)
+	{
+		closeSocket(m_socket, m_epoll);
+		m_connected = false;
+	}
+}
+
+bool gg::ConnectionBackend::isAlive() const
+{
+	return m_connected;
+}
+
+const std::string& gg::ConnectionBackend::getAddress() const
+{
+	return m_address;
+}
+
+size_t gg::ConnectionBackend::availableData()
+{
+	if (!m_connected)
+		return 0;
+
+	return getAvailableData(m_socket);
+}
+
+size_t gg::ConnectionBackend::waitForData(size_t len, uint32_t timeoutMs)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t available_bytes = waitForSocketData(m_socket, m_epoll, len, timeoutMs, alive);
+	if (!alive)
+		disconnect();
+
+	return available_bytes;
+}
+
+size_t gg::ConnectionBackend::peek(char* ptr, size_t len)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_read = receive(m_socket, ptr, len, MSG_PEEK, m_tcp, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_read;
+}
+
+size_t gg::ConnectionBackend::read(char* ptr, size_t len)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_read = receive(m_socket, ptr, len, 0, m_tcp, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_read;
+}
+
+size_t gg::ConnectionBackend::write(const char* ptr, size_t len)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_written = transmit(m_socket, m_epoll, ptr, len, m_tcp ? nullptr : &m_sockaddr, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_written;
+}
+
+SOCKET gg::ConnectionBackend::getSocket() const
+{
+	return m_socket;
+}
+
+bool gg::ConnectionBackend::isStream() const
+{
+	return m_tcp;
+}
+
+size_t gg::ConnectionBackend::write(const WriteBuffer* buffers, size_t count)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_written = transmitBuffers(m_socket, buffers, count, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_written;
+}
+
+bool gg::ConnectionBackend::waitForWritable(uint32_t timeoutMs)
+{
+	if (!m_connected)
+		return false;
+
+	uint32_t events = waitForEdge(m_epoll, timeoutMs);
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		disconnect();
+		return false;
+	}
+
+	return ((events & EPOLLOUT) != 0);
+}
+
+
+gg::ClientBackendTCP::ClientBackendTCP(SOCKET socket, SOCKADDR_STORAGE& sockaddr) :
+	m_socket(socket),
+	m_epoll(createPoller(socket)),
+	m_sockaddr(sockaddr),
+	m_connected(m_epoll != -1)
+{
+	m_address = getHostFromSockaddr(&sockaddr) + ":" + std::to_string(getPortFromSockaddr(&sockaddr));
+
+	if (!m_connected)
+		closeSocket(m_socket, m_epoll);
+}
+
+gg::ClientBackendTCP::~ClientBackendTCP()
+{
+	disconnect();
+}
+
+bool gg::ClientBackendTCP::connect(void*)
+{
+	return false;
+}
+
+void gg::ClientBackendTCP::disconnect()
+{
+	if (m_connected)
+	{
+		closeSocket(m_socket, m_epoll);
+		m_connected = false;
+	}
+}
+
+bool gg::ClientBackendTCP::isAlive() const
+{
+	return m_connected;
+}
+
+const std::string& gg::ClientBackendTCP::getAddress() const
+{
+	return m_address;
+}
+
+size_t gg::ClientBackendTCP::availableData()
+{
+	if (!m_connected)
+		return 0;
+
+	return getAvailableData(m_socket);
+}
+
+size_t gg::ClientBackendTCP::waitForData(size_t len, uint32_t timeoutMs)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t available_bytes = waitForSocketData(m_socket, m_epoll, len, timeoutMs, alive);
+	if (!alive)
+		disconnect();
+
+	return available_bytes;
+}
+
+size_t gg::ClientBackendTCP::peek(char* ptr, size_t len)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_read = receive(m_socket, ptr, len, MSG_PEEK, true, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_read;
+}
+
+size_t gg::ClientBackendTCP::read(char* ptr, size_t len)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_read = receive(m_socket, ptr, len, 0, true, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_read;
+}
+
+size_t gg::ClientBackendTCP::write(const char* ptr, size_t len)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_written = transmit(m_socket, m_epoll, ptr, len, nullptr, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_written;
+}
+
+SOCKET gg::ClientBackendTCP::getSocket() const
+{
+	return m_socket;
+}
+
+bool gg::ClientBackendTCP::isStream() const
+{
+	return true;
+}
+
+size_t gg::ClientBackendTCP::write(const WriteBuffer* buffers, size_t count)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_written = transmitBuffers(m_socket, buffers, count, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_written;
+}
+
+bool gg::ClientBackendTCP::waitForWritable(uint32_t timeoutMs)
+{
+	if (!m_connected)
+		return false;
+
+	uint32_t events = waitForEdge(m_epoll, timeoutMs);
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		disconnect();
+		return false;
+	}
+
+	return ((events & EPOLLOUT) != 0);
+}
+
+
+gg::ClientBackendUDP::ClientBackendUDP(SOCKET socket, SOCKADDR_STORAGE& sockaddr) :
+	m_socket(socket),
+	m_sockaddr(sockaddr),
+	m_data_len(0),
+	m_data_pos(0)
+{
+	m_address = getHostFromSockaddr(&sockaddr) + ":" + std::to_string(getPortFromSockaddr(&sockaddr));
+}
+
+gg::ClientBackendUDP::~ClientBackendUDP()
+{
+}
+
+bool gg::ClientBackendUDP::connect(void*)
+{
+	return false;
+}
+
+void gg::ClientBackendUDP::disconnect()
+{
+}
+
+bool gg::ClientBackendUDP::isAlive() const
+{
+	return false;
+}
+
+const std::string& gg::ClientBackendUDP::getAddress() const
+{
+	return m_address;
+}
+
+size_t gg::ClientBackendUDP::availableData()
+{
+	return m_data_len - m_data_pos;
+}
+
+size_t gg::ClientBackendUDP::waitForData(size_t, uint32_t)
+{
+	return availableData();
+}
+
+size_t gg::ClientBackendUDP::peek(char* ptr, size_t len)
+{
+	if (len > m_data_len - m_data_pos)
+		len = m_data_len - m_data_pos;
+
+	std::memcpy(ptr, &m_data[m_data_pos], len);
+	return len;
+}
+
+size_t gg::ClientBackendUDP::read(char* ptr, size_t len)
+{
+	if (len > m_data_len - m_data_pos)
+		len = m_data_len - m_data_pos;
+
+	std::memcpy(ptr, &m_data[m_data_pos], len);
+	m_data_pos += len;
+	return len;
+}
+
+size_t gg::ClientBackendUDP::write(const char* ptr, size_t len)
+{
+	if (len > Stream::BUF_SIZE - m_data_len)
+		len = Stream::BUF_SIZE - m_data_len;
+
+	std::memcpy(&m_data[m_data_len], ptr, len);
+	m_data_len += len;
+	return len;
+}
+
+
+gg::ServerBackend::ServerBackend(uint16_t port, bool tcp, bool ipv6) :
+	m_socket(INVALID_SOCKET),
+	m_epoll(-1),
+	m_port(port),
+	m_tcp(tcp),
+	m_ipv6(ipv6),
+	m_started(false)
+{
+}
+
+gg::ServerBackend::~ServerBackend()
+{
+	stop();
+}
+
+bool gg::ServerBackend::start(void*)
+{
+	if (m_started) return false;
+
+	std::string port = std::to_string(m_port);
+	struct addrinfo hints, *result = NULL, *ptr = NULL;
+
+	std::memset(&m_sockaddr, 0, sizeof(SOCKADDR_STORAGE));
+
+	std::memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = m_ipv6 ? AF_INET6 : AF_INET;
+	hints.ai_socktype = m_tcp ? SOCK_STREAM : SOCK_DGRAM;
+	hints.ai_protocol = m_tcp ? IPPROTO_TCP : IPPROTO_UDP;
+	hints.ai_flags = AI_PASSIVE;
+
+	// resolve the local address and port to be used by the server
+	if (getaddrinfo(NULL, port.c_str(), &hints, &result) != 0)
+	{
+		return false;
+	}
+
+	m_socket = INVALID_SOCKET;
+
+	// attempt to bind to the first possible address in the list returned by getaddrinfo
+	for (ptr = result; ptr != NULL; ptr = ptr->ai_next)
+	{
+		m_socket = socket(ptr->ai_family, ptr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ptr->ai_protocol);
+		if (m_socket == INVALID_SOCKET)
+		{
+			continue;
+		}
+
+		int no = 0;
+		int yes = 1;
+		if (ptr->ai_family == AF_INET6)
+			setsockopt(m_socket, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+		setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+		if (::bind(m_socket, ptr->ai_addr, ptr->ai_addrlen) == SOCKET_ERROR)
+		{
+			close(m_socket);
+			m_socket = INVALID_SOCKET;
+			continue;
+		}
+
+		if (m_tcp && ::listen(m_socket, SOMAXCONN) == SOCKET_ERROR)
+		{
+			close(m_socket);
+			m_socket = INVALID_SOCKET;
+			continue;
+		}
+
+		// everything is OK if we get here
+		break;
+	}
+
+	freeaddrinfo(result);
+
+	if (m_socket == INVALID_SOCKET)
+	{
+		return false;
+	}
+
+	m_epoll = createPoller(m_socket);
+	if (m_epoll == -1)
+	{
+		closeSocket(m_socket, m_epoll);
+		return false;
+	}
+
+	m_started = true;
+	return true;
+}
+
+void gg::ServerBackend::stop()
+{
+	closeSocket(m_socket, m_epoll);
+	m_started = false;
+}
+
+bool gg::ServerBackend::isAlive() const
+{
+	return m_started;
+}
+
+gg::ConnectionBackendPtr gg::ServerBackend::getNextConnection(uint32_t timeoutMs)
+{
+	ConnectionBackendPtr client;
+
+	if (!m_started)
+		return {};
+
+	SOCKADDR_STORAGE addr;
+	socklen_t addrlen;
+
+	// the socket is only waited on if there is nothing to accept right away
+	for (bool waited = false; ; waited = true)
+	{
+		addrlen = sizeof(SOCKADDR_STORAGE);
+
+		if (m_tcp) // we are TCP
+		{
+			SOCKET sock = accept4(m_socket, reinterpret_cast<struct sockaddr*>(&addr), &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (sock != INVALID_SOCKET)
+			{
+				client.reset(new ClientBackendTCP(sock, addr));
+				break;
+			}
+		}
+		else // we are UDP
+		{
+			char buf[2048];
+			ssize_t len = recvfrom(m_socket, buf, sizeof(buf), 0, reinterpret_cast<struct sockaddr*>(&addr), &addrlen);
+			if (len >= 0)
+			{
+				client.reset(new ClientBackendUDP(m_socket, addr));
+				client->write(buf, static_cast<size_t>(len));
+				break;
+			}
+		}
+
+		// the client might have given up before its connection was accepted
+		if (errno == ECONNABORTED || errno == EINTR)
+			break;
+
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			stop();
+			break;
+		}
+
+		if (waited || timeoutMs == 0)
+			break;
+
+		if (waitForEdge(m_epoll, timeoutMs) & EPOLLERR)
+		{
+			stop();
+			break;
+		}
+	}
+
+	return client;
+}
+
+#endif // _WIN32
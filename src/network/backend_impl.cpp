@@ -47,6 +47,31 @@ static std::string getHostFromSockaddr(SOCKADDR_STORAGE* sockaddr)
 	return str;
 }
 
+// returns the bytes written, a blocking socket writes all of them
+static size_t transmitBuffers(SOCKET socket, const gg::WriteBuffer* buffers, size_t count, bool& alive)
+{
+	WSABUF wsabufs[gg::ISocketBackend::MAX_WRITE_BUFFERS];
+	if (count > gg::ISocketBackend::MAX_WRITE_BUFFERS)
+		count = gg::ISocketBackend::MAX_WRITE_BUFFERS;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		wsabufs[i].buf = const_cast<char*>(buffers[i].ptr);
+		wsabufs[i].len = static_cast<ULONG>(buffers[i].len);
+	}
+
+	DWORD bytes_sent = 0;
+	if (WSASend(socket, wsabufs, static_cast<DWORD>(count), &bytes_sent, 0, NULL, NULL) == SOCKET_ERROR)
+	{
+		if (WSAGetLastError() != WSAEWOULDBLOCK)
+			alive = false;
+
+		return 0;
+	}
+
+	return static_cast<size_t>(bytes_sent);
+}
+
 
 gg::ConnectionBackend::ConnectionBackend(const std::string& host, uint16_t port, bool tcp, bool ipv6) :
 	m_socket(INVALID_SOCKET),
@@ -238,7 +263,15 @@ size_t gg::ConnectionBackend::read(char* ptr, size_t len)
 	}
 	else if (rc > 0)
 	{
-		return recv(m_socket, ptr, len, 0);
+		// the socket is readable, so no data means the peer closed the connection
+		int bytes_read = recv(m_socket, ptr, len, 0);
+		if (bytes_read == SOCKET_ERROR || (m_tcp && bytes_read == 0))
+		{
+			disconnect();
+			return 0;
+		}
+
+		return bytes_read;
 	}
 	else
 	{
@@ -271,6 +304,52 @@ size_t gg::ConnectionBackend::write(const char* ptr, size_t len)
 	}
 }
 
+SOCKET gg::ConnectionBackend::getSocket() const
+{
+	return m_socket;
+}
+
+bool gg::ConnectionBackend::isStream() const
+{
+	return m_tcp;
+}
+
+size_t gg::ConnectionBackend::write(const WriteBuffer* buffers, size_t count)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_written = transmitBuffers(m_socket, buffers, count, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_written;
+}
+
+bool gg::ConnectionBackend::waitForWritable(uint32_t timeoutMs)
+{
+	if (!m_connected)
+		return false;
+
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(m_socket, &set);
+
+	struct timeval timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+	int rc = select(m_socket + 1, NULL, &set, NULL, (timeoutMs == UINT32_MAX) ? NULL : &timeout);
+	if (rc == SOCKET_ERROR)
+	{
+		disconnect();
+		return false;
+	}
+
+	return (rc > 0);
+}
+
 
 gg::ClientBackendTCP::ClientBackendTCP(SOCKET socket, SOCKADDR_STORAGE& sockaddr) :
 	m_socket(socket),
@@ -403,7 +482,15 @@ size_t gg::ClientBackendTCP::read(char* ptr, size_t len)
 	}
 	else if (rc > 0)
 	{
-		return recv(m_socket, ptr, len, 0);
+		// the socket is readable, so no data means the peer closed the connection
+		int bytes_read = recv(m_socket, ptr, len, 0);
+		if (bytes_read == SOCKET_ERROR || bytes_read == 0)
+		{
+			disconnect();
+			return 0;
+		}
+
+		return bytes_read;
 	}
 	else
 	{
@@ -428,6 +515,52 @@ size_t gg::ClientBackendTCP::write(const char* ptr, size_t len)
 	}
 }
 
+SOCKET gg::ClientBackendTCP::getSocket() const
+{
+	return m_socket;
+}
+
+bool gg::ClientBackendTCP::isStream() const
+{
+	return true;
+}
+
+size_t gg::ClientBackendTCP::write(const WriteBuffer* buffers, size_t count)
+{
+	if (!m_connected)
+		return 0;
+
+	bool alive = true;
+	size_t bytes_written = transmitBuffers(m_socket, buffers, count, alive);
+	if (!alive)
+		disconnect();
+
+	return bytes_written;
+}
+
+bool gg::ClientBackendTCP::waitForWritable(uint32_t timeoutMs)
+{
+	if (!m_connected)
+		return false;
+
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(m_socket, &set);
+
+	struct timeval timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+	int rc = select(m_socket + 1, NULL, &set, NULL, (timeoutMs == UINT32_MAX) ? NULL : &timeout);
+	if (rc == SOCKET_ERROR)
+	{
+		disconnect();
+		return false;
+	}
+
+	return (rc > 0);
+}
+
 
 gg::ClientBackendUDP::ClientBackendUDP(SOCKET socket, SOCKADDR_STORAGE& sockaddr) :
 	m_socket(socket),
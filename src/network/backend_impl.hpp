@@ -13,15 +13,35 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #else
+#include <sys/socket.h>
 typedef int SOCKET;
-typedef int SOCKADDR_STORAGE;
+typedef struct sockaddr_storage SOCKADDR_STORAGE;
+const SOCKET INVALID_SOCKET = -1;
 #endif // _WIN32
 
 #include "network_impl.hpp"
 
 namespace gg
 {
-	class ConnectionBackend : public IConnectionBackend
+	struct WriteBuffer
+	{
+		const char* ptr;
+		size_t len;
+	};
+
+	class ISocketBackend // backends of our own sockets, they can be waited for by a reactor and written in batches
+	{
+	public:
+		enum : size_t { MAX_WRITE_BUFFERS = 192 }; // by a single write()
+
+		virtual ~ISocketBackend() = default;
+		virtual SOCKET getSocket() const = 0;
+		virtual bool isStream() const = 0; // buffers of a datagram socket can't be coalesced
+		virtual size_t write(const WriteBuffer*, size_t count) = 0; // returns the bytes written, might be less than all
+		virtual bool waitForWritable(uint32_t timeoutMs) = 0;
+	};
+
+	class ConnectionBackend : public IConnectionBackend, public ISocketBackend
 	{
 	public:
 		ConnectionBackend(const std::string& host, uint16_t port, bool tcp = true, bool ipv6 = false);
@@ -35,9 +55,16 @@ namespace gg
 		virtual size_t peek(char* ptr, size_t len);
 		virtual size_t read(char* ptr, size_t len);
 		virtual size_t write(const char* ptr, size_t len);
+		virtual SOCKET getSocket() const;
+		virtual bool isStream() const;
+		virtual size_t write(const WriteBuffer*, size_t count);
+		virtual bool waitForWritable(uint32_t timeoutMs);
 
 	private:
 		SOCKET m_socket;
+#ifndef _WIN32
+		int m_epoll; // edge-triggered readiness of m_socket
+#endif
 		SOCKADDR_STORAGE m_sockaddr;
 		std::string m_host;
 		uint16_t m_port;
@@ -47,7 +74,7 @@ namespace gg
 		bool m_connected;
 	};
 
-	class ClientBackendTCP : public IConnectionBackend
+	class ClientBackendTCP : public IConnectionBackend, public ISocketBackend
 	{
 	public:
 		ClientBackendTCP(SOCKET, SOCKADDR_STORAGE&);
@@ -61,9 +88,16 @@ namespace gg
 		virtual size_t peek(char* ptr, size_t len);
 		virtual size_t read(char* ptr, size_t len);
 		virtual size_t write(const char* ptr, size_t len);
+		virtual SOCKET getSocket() const;
+		virtual bool isStream() const;
+		virtual size_t write(const WriteBuffer*, size_t count);
+		virtual bool waitForWritable(uint32_t timeoutMs);
 
 	private:
 		SOCKET m_socket;
+#ifndef _WIN32
+		int m_epoll; // edge-triggered readiness of m_socket
+#endif
 		SOCKADDR_STORAGE m_sockaddr;
 		std::string m_address; // host + port
 		bool m_connected;
@@ -105,6 +139,9 @@ namespace gg
 
 	private:
 		SOCKET m_socket;
+#ifndef _WIN32
+		int m_epoll; // edge-triggered readiness of m_socket
+#endif
 		SOCKADDR_STORAGE m_sockaddr;
 		uint16_t m_port;
 		bool m_tcp;
@@ -0,0 +1,131 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <new>
+#include <utility>
+#include "gg/poolallocator.hpp"
+#include "bufferpool.hpp"
+
+static_assert((gg::BufferPool::MIN_SLAB_SIZE << 4) == gg::BufferPool::MAX_POOLED_SLAB_SIZE, "the pooled size classes of BufferPool::allocate() are out of date");
+
+
+gg::Slab::Slab() :
+	m_header(nullptr)
+{
+}
+
+gg::Slab::Slab(Header* header) :
+	m_header(header)
+{
+}
+
+gg::Slab::Slab(const Slab& slab) :
+	m_header(slab.m_header)
+{
+	if (m_header)
+		m_header->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+gg::Slab::Slab(Slab&& slab) :
+	m_header(slab.m_header)
+{
+	slab.m_header = nullptr;
+}
+
+gg::Slab::~Slab()
+{
+	if (m_header && m_header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		BufferPool::release(m_header);
+}
+
+gg::Slab& gg::Slab::operator= (Slab slab)
+{
+	std::swap(m_header, slab.m_header);
+	return *this;
+}
+
+char* gg::Slab::getData() const
+{
+	return reinterpret_cast<char*>(m_header + 1);
+}
+
+size_t gg::Slab::getCapacity() const
+{
+	return m_header ? (static_cast<size_t>(BufferPool::MIN_SLAB_SIZE) << m_header->size_class) : 0;
+}
+
+bool gg::Slab::isShared() const
+{
+	return (m_header && m_header->refs.load(std::memory_order_acquire) > 1);
+}
+
+gg::Slab::operator bool() const
+{
+	return (m_header != nullptr);
+}
+
+
+size_t gg::BufferPool::getSlabSize(size_t size)
+{
+	size_t slab_size = MIN_SLAB_SIZE;
+	while (slab_size < size && slab_size < MAX_SLAB_SIZE)
+		slab_size <<= 1;
+
+	return slab_size;
+}
+
+template<size_t SlabSize>
+gg::Slab::Header* gg::BufferPool::allocateBlock()
+{
+	return static_cast<Slab::Header*>(BlockPool<sizeof(Slab::Header) + SlabSize, alignof(std::max_align_t)>::allocate());
+}
+
+template<size_t SlabSize>
+void gg::BufferPool::deallocateBlock(Slab::Header* header)
+{
+	BlockPool<sizeof(Slab::Header) + SlabSize, alignof(std::max_align_t)>::deallocate(header);
+}
+
+gg::Slab gg::BufferPool::allocate(size_t size)
+{
+	size_t size_class = 0;
+	while ((static_cast<size_t>(MIN_SLAB_SIZE) << size_class) < size && (static_cast<size_t>(MIN_SLAB_SIZE) << size_class) < MAX_SLAB_SIZE)
+		++size_class;
+
+	Slab::Header* header;
+	switch (size_class)
+	{
+	case 0: header = allocateBlock<MIN_SLAB_SIZE>(); break;
+	case 1: header = allocateBlock<MIN_SLAB_SIZE << 1>(); break;
+	case 2: header = allocateBlock<MIN_SLAB_SIZE << 2>(); break;
+	case 3: header = allocateBlock<MIN_SLAB_SIZE << 3>(); break;
+	case 4: header = allocateBlock<MIN_SLAB_SIZE << 4>(); break;
+	default: header = static_cast<Slab::Header*>(::operator new(sizeof(Slab::Header) + (static_cast<size_t>(MIN_SLAB_SIZE) << size_class)));
+	}
+
+	new (header) Slab::Header();
+	header->refs.store(1, std::memory_order_relaxed);
+	header->size_class = size_class;
+	return Slab(header);
+}
+
+void gg::BufferPool::release(Slab::Header* header)
+{
+	size_t size_class = header->size_class;
+	header->~Header();
+
+	switch (size_class)
+	{
+	case 0: deallocateBlock<MIN_SLAB_SIZE>(header); break;
+	case 1: deallocateBlock<MIN_SLAB_SIZE << 1>(header); break;
+	case 2: deallocateBlock<MIN_SLAB_SIZE << 2>(header); break;
+	case 3: deallocateBlock<MIN_SLAB_SIZE << 3>(header); break;
+	case 4: deallocateBlock<MIN_SLAB_SIZE << 4>(header); break;
+	default: ::operator delete(header);
+	}
+}
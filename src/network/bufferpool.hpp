@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace gg
+{
+	class BufferPool;
+
+	// reference counted handle of a pooled slab, the last handle gives the slab back
+	class Slab
+	{
+	public:
+		Slab();
+		Slab(const Slab&);
+		Slab(Slab&&);
+		~Slab();
+		Slab& operator= (Slab);
+		char* getData() const;
+		size_t getCapacity() const;
+		bool isShared() const; // other handles reference the same slab
+		explicit operator bool() const;
+
+	private:
+		struct Header
+		{
+			std::atomic<size_t> refs;
+			size_t size_class;
+		};
+
+		Header* m_header;
+
+		explicit Slab(Header*);
+
+		friend class BufferPool;
+	};
+
+	// slabs are sized in powers of two, the small ones come from the per-thread block pools
+	class BufferPool
+	{
+	public:
+		enum : size_t { MIN_SLAB_SIZE = 256 };
+		enum : size_t { MAX_POOLED_SLAB_SIZE = 4 * 1024 }; // larger slabs are rare, their size outweighs a heap allocation
+		enum : size_t { MAX_SLAB_SIZE = 64 * 1024 };
+
+		static size_t getSlabSize(size_t size); // the next power of two between MIN_SLAB_SIZE and MAX_SLAB_SIZE
+		static Slab allocate(size_t size); // the capacity is getSlabSize(size)
+
+	private:
+		template<size_t SlabSize>
+		static Slab::Header* allocateBlock();
+
+		template<size_t SlabSize>
+		static void deallocateBlock(Slab::Header*);
+
+		static void release(Slab::Header*);
+
+		friend class Slab;
+	};
+};
@@ -8,8 +8,11 @@
 
 #include <cstring>
 #include <stdexcept>
+#include "gg/poolallocator.hpp"
+#include "gg/timer.hpp"
 #include "network_impl.hpp"
 #include "backend_impl.hpp"
+#include "reactor_impl.hpp"
 
 static gg::NetworkManager s_netmgr;
 gg::INetworkManager& gg::net = s_netmgr;
@@ -19,8 +22,11 @@ gg::Packet::Packet(Mode mode, Type type) :
 	Stream(mode),
 	m_type(type),
 	m_data_len(0),
-	m_data_pos(0)
+	m_read_segment(0),
+	m_read_pos(0)
 {
+	m_first.offset = 0;
+	m_first.len = 0;
 }
 
 gg::Packet::~Packet()
@@ -34,22 +40,31 @@ gg::IPacket::Type gg::Packet::getType() const
 
 const char* gg::Packet::getData() const
 {
-	return m_data;
-}
+	if (!m_first.slab)
+		return nullptr;
 
-size_t gg::Packet::getSize() const
-{
-	return m_data_len;
-}
+	if (m_more.empty())
+		return m_first.slab.getData() + m_first.offset;
 
-char* gg::Packet::getDataPtr()
-{
-	return m_data;
+	if (!m_joined_data)
+	{
+		m_joined_data.reset(new char[m_data_len]);
+
+		size_t pos = 0;
+		for (size_t i = 0, count = getSegmentCount(); i < count; ++i)
+		{
+			const Segment& segment = getSegment(i);
+			std::memcpy(&m_joined_data[pos], segment.slab.getData() + segment.offset, segment.len);
+			pos += segment.len;
+		}
+	}
+
+	return m_joined_data.get();
 }
 
-void gg::Packet::setSize(size_t size)
+size_t gg::Packet::getSize() const
 {
-	m_data_len = size;
+	return m_data_len;
 }
 
 size_t gg::Packet::write(const char* ptr, size_t len)
@@ -57,11 +72,19 @@ size_t gg::Packet::write(const char* ptr, size_t len)
 	if (getMode() != Mode::SERIALIZE)
 		throw SerializationError();
 
-	if (BUF_SIZE - m_data_len < len)
-		len = BUF_SIZE - m_data_len;
+	if (MAX_SIZE - m_data_len < len)
+		len = MAX_SIZE - m_data_len;
+
+	size_t bytes_written = 0;
+	while (bytes_written < len)
+	{
+		size_t free_space = len - bytes_written;
+		char* buffer = reserve(free_space);
+		std::memcpy(buffer, ptr + bytes_written, free_space);
+		commit(free_space);
+		bytes_written += free_space;
+	}
 
-	std::memcpy(&m_data[m_data_len], ptr, len);
-	m_data_len += len;
 	return len;
 }
 
@@ -70,17 +93,134 @@ size_t gg::Packet::read(char* ptr, size_t len)
 	if (getMode() != Mode::DESERIALIZE)
 		throw SerializationError();
 
-	if (m_data_len - m_data_pos < len)
-		len = m_data_len - m_data_pos;
+	size_t bytes_read = 0;
+	for (size_t count = getSegmentCount(); bytes_read < len && m_read_segment < count; )
+	{
+		const Segment& segment = getSegment(m_read_segment);
+		size_t segment_len = segment.len - m_read_pos;
+		if (segment_len > len - bytes_read)
+			segment_len = len - bytes_read;
 
-	std::memcpy(ptr, &m_data[m_data_pos], len);
-	m_data_pos += len;
-	return len;
+		std::memcpy(ptr + bytes_read, segment.slab.getData() + segment.offset + m_read_pos, segment_len);
+		bytes_read += segment_len;
+		m_read_pos += segment_len;
+
+		if (m_read_pos == segment.len)
+		{
+			++m_read_segment;
+			m_read_pos = 0;
+		}
+	}
+
+	return bytes_read;
+}
+
+size_t gg::Packet::getSegmentCount() const
+{
+	return m_first.slab ? (1 + m_more.size()) : 0;
+}
+
+const gg::Packet::Segment& gg::Packet::getSegment(size_t n) const
+{
+	return (n == 0) ? m_first : m_more[n - 1];
+}
+
+void gg::Packet::append(const Slab& slab, size_t offset, size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (m_first.slab)
+	{
+		Segment& last = getLastSegment();
+		if (last.slab.getData() == slab.getData() && last.offset + last.len == offset)
+		{
+			last.len += len;
+		}
+		else
+		{
+			Segment segment = { slab, offset, len };
+			m_more.push_back(std::move(segment));
+		}
+	}
+	else
+	{
+		m_first.slab = slab;
+		m_first.offset = offset;
+		m_first.len = len;
+	}
+
+	m_data_len += len;
+	m_joined_data.reset();
+}
+
+char* gg::Packet::reserve(size_t& len)
+{
+	if (m_first.slab)
+	{
+		// the bytes after the last segment are free unless the slab is shared with someone else
+		Segment& last = getLastSegment();
+		size_t end = last.offset + last.len;
+		if (end < last.slab.getCapacity() && !last.slab.isShared())
+		{
+			if (len > last.slab.getCapacity() - end)
+				len = last.slab.getCapacity() - end;
+
+			return last.slab.getData() + end;
+		}
+
+		// a single slab is replaced by a larger one, so packets stay contiguous up to the largest slab size
+		if (m_more.empty() && m_first.slab.getCapacity() < BufferPool::MAX_SLAB_SIZE)
+		{
+			Slab slab = BufferPool::allocate(m_first.len + len);
+			std::memcpy(slab.getData(), m_first.slab.getData() + m_first.offset, m_first.len);
+			m_first.slab = std::move(slab);
+			m_first.offset = 0;
+			m_joined_data.reset();
+
+			if (len > m_first.slab.getCapacity() - m_first.len)
+				len = m_first.slab.getCapacity() - m_first.len;
+
+			return m_first.slab.getData() + m_first.len;
+		}
+	}
+
+	// chained slabs grow with the packet, so the number of segments stays low
+	Segment segment = { BufferPool::allocate((m_data_len > len) ? m_data_len : len), 0, 0 };
+	if (len > segment.slab.getCapacity())
+		len = segment.slab.getCapacity();
+
+	char* ptr = segment.slab.getData();
+	if (m_first.slab)
+		m_more.push_back(std::move(segment));
+	else
+		m_first = std::move(segment);
+
+	return ptr;
+}
+
+void gg::Packet::commit(size_t len)
+{
+	getLastSegment().len += len;
+	m_data_len += len;
+	m_joined_data.reset();
+}
+
+gg::Packet::Segment& gg::Packet::getLastSegment()
+{
+	return m_more.empty() ? m_first : m_more.back();
 }
 
 
 gg::Connection::Connection(ConnectionBackendPtr&& backend) :
-	m_backend(std::move(backend))
+	m_backend(std::move(backend)),
+	m_socket_backend(dynamic_cast<ISocketBackend*>(m_backend.get())),
+	m_recv_begin(0),
+	m_recv_end(0),
+	m_large_missing(0),
+	m_send_buffer_begin(0),
+	m_send_offset(0),
+	m_queued_data(0)
 {
 }
 
@@ -98,6 +238,10 @@ bool gg::Connection::connect(void* user_data)
 void gg::Connection::disconnect()
 {
 	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (!m_send_queue.empty())
+		flushQueue(0, LINGER_TIMEOUT);
+
 	m_backend->disconnect();
 }
 
@@ -113,44 +257,73 @@ const std::string& gg::Connection::getAddress() const
 	return m_backend->getAddress();
 }
 
+gg::IConnectionBackend* gg::Connection::getBackend() const
+{
+	return m_backend.get();
+}
+
 gg::PacketPtr gg::Connection::getNextPacket(uint32_t timeoutMs)
 {
 	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
 
-	StreamHeader head;
-	if (m_backend->peek(reinterpret_cast<char*>(&head), sizeof(StreamHeader)) < sizeof(StreamHeader))
-		return {};
+	// packets left in the queue by a full socket buffer are written by the regular polls too
+	if (!m_send_queue.empty())
+		writeQueue();
 
-	if (head.packet_size > Stream::BUF_SIZE)
-		throw NetworkException("Too large packet");
+	PacketPtr packet = readPacket();
+	if (packet || timeoutMs == 0)
+		return packet;
 
-	size_t expected_size = sizeof(StreamHeader) + head.packet_size + sizeof(StreamTail);
-	if (m_backend->waitForData(expected_size, timeoutMs) < expected_size)
-		return {};
+	Timer timer;
+
+	for (;;)
+	{
+		uint64_t elapsed = timer.peekElapsed();
+		if (elapsed >= timeoutMs)
+			return {};
 
-	// now that we have the full packet, let's skip the first heading bytes we already know
-	m_backend->read(reinterpret_cast<char*>(&head), sizeof(StreamHeader));
+		// large frames are waited for in parts, they are read while the rest of them arrives
+		size_t missing_data = getMissingData();
+		if (missing_data > MAX_WAITED_DATA)
+			missing_data = MAX_WAITED_DATA;
 
-	std::shared_ptr<Packet> packet(new Packet(IStream::Mode::DESERIALIZE, head.packet_type));
-	m_backend->read(packet->getDataPtr(), head.packet_size);
-	packet->setSize(head.packet_size);
+		size_t available_data = m_backend->waitForData(missing_data, static_cast<uint32_t>(timeoutMs - elapsed));
+		if (available_data == 0)
+			return {};
 
-	StreamTail tail;
-	m_backend->read(reinterpret_cast<char*>(&tail), sizeof(StreamTail));
-	if (!tail.ok())
-		throw NetworkException("Corrupted packet");
+		packet = readPacket();
+		if (packet || available_data < missing_data)
+			return packet;
+	}
+}
 
-	return packet;
+size_t gg::Connection::getNextPackets(std::vector<PacketPtr>& packets, size_t max_packets, uint32_t timeoutMs)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	// only the first packet is waited for, the rest of the batch is what has already arrived
+	size_t count = 0;
+	while (count < max_packets)
+	{
+		PacketPtr packet = (count == 0) ? getNextPacket(timeoutMs) : readPacket();
+		if (!packet)
+			break;
+
+		packets.push_back(std::move(packet));
+		++count;
+	}
+
+	return count;
 }
 
 gg::PacketPtr gg::Connection::createPacket(IPacket::Type type) const
 {
-	return PacketPtr( new Packet(IStream::Mode::SERIALIZE, type) );
+	return std::allocate_shared<Packet>(PoolAllocator<Packet>(), IStream::Mode::SERIALIZE, type);
 }
 
 gg::PacketPtr gg::Connection::createPacket(EventPtr event) const
 {
-	PacketPtr packet( new Packet(IStream::Mode::SERIALIZE, event->getType()) );
+	PacketPtr packet = std::allocate_shared<Packet>(PoolAllocator<Packet>(), IStream::Mode::SERIALIZE, event->getType());
 	event->serialize(*packet);
 	return packet;
 }
@@ -159,26 +332,470 @@ bool gg::Connection::send(PacketPtr packet)
 {
 	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
 
+	if (!m_socket_backend || !m_socket_backend->isStream())
+		return writeFrame(packet);
+
+	if (!m_backend->isAlive())
+		return false;
+
+	// a non-empty queue means the socket was full, new packets wait behind it,
+	// but whatever the socket takes by now is written without blocking
+	if (!m_send_queue.empty())
+	{
+		queuePacket(packet);
+		return flushQueue(MAX_QUEUED_DATA, UINT32_MAX);
+	}
+
+	// large packets are written from their own slabs
+	if (MAX_HEADER_SIZE + packet->getSize() + sizeof(StreamTail) > MAX_STACK_FRAME_SIZE)
+	{
+		queuePacket(packet);
+		return flushQueue(MAX_QUEUED_DATA, UINT32_MAX);
+	}
+
+	// usually there's room for the whole frame, only the rest of it is queued if there isn't
+	char buffer[MAX_STACK_FRAME_SIZE];
+	WriteBuffer frame = { buffer, buildFrame(packet, buffer) };
+
+	size_t bytes_written = m_socket_backend->write(&frame, 1);
+	if (bytes_written < frame.len)
+		queueBytes(frame.ptr + bytes_written, frame.len - bytes_written);
+
+	return m_backend->isAlive();
+}
+
+bool gg::Connection::send(const std::vector<PacketPtr>& packets)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (!m_socket_backend || !m_socket_backend->isStream())
+	{
+		for (auto& packet : packets)
+		{
+			if (!writeFrame(packet))
+				return false;
+		}
+
+		return true;
+	}
+
+	if (!m_backend->isAlive())
+		return false;
+
+	for (auto& packet : packets)
+		queuePacket(packet);
+
+	// only blocks if the socket can't keep up
+	return flushQueue(MAX_QUEUED_DATA, UINT32_MAX);
+}
+
+bool gg::Connection::flush(uint32_t timeoutMs)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	return flushQueue(0, timeoutMs);
+}
+
+bool gg::Connection::isDatagram() const
+{
+	// external backends are read like a stream
+	return (m_socket_backend && !m_socket_backend->isStream());
+}
+
+gg::PacketPtr gg::Connection::readPacket()
+{
+	for (;;)
+	{
+		PacketPtr packet = parsePacket();
+		if (packet || !receiveData())
+			return packet;
+	}
+}
+
+gg::PacketPtr gg::Connection::parsePacket()
+{
+	size_t buffered = m_recv_end - m_recv_begin;
+
+	// only the tail of a large frame is read into the buffer
+	if (m_large_packet)
+	{
+		if (m_large_missing > 0 || buffered < sizeof(StreamTail))
+			return {};
+
+		StreamTail tail;
+		std::memcpy(&tail, m_recv_buffer.getData() + m_recv_begin, sizeof(StreamTail));
+		if (!tail.ok())
+			throw NetworkException("Corrupted packet");
+
+		m_recv_begin += sizeof(StreamTail);
+		return std::move(m_large_packet);
+	}
+
+	size_t header_size;
+	size_t packet_size;
+	IPacket::Type packet_type;
+	if (!parseHeader(header_size, packet_size, packet_type))
+		return {};
+
+	if (packet_size > Packet::MAX_SIZE)
+		throw NetworkException("Too large packet");
+
+	const char* frame = m_recv_buffer.getData() + m_recv_begin;
+	size_t frame_size = header_size + packet_size + sizeof(StreamTail);
+
+	if (frame_size > RECV_BUFFER_SIZE)
+	{
+		if (isDatagram())
+			throw NetworkException("Too large packet");
+
+		// the received part of the payload is referenced, the rest is read right into the packet
+		size_t len = buffered - header_size;
+		if (len > packet_size)
+			len = packet_size;
+
+		m_large_packet = std::allocate_shared<Packet>(PoolAllocator<Packet>(), IStream::Mode::DESERIALIZE, packet_type);
+		m_large_packet->append(m_recv_buffer, m_recv_begin + header_size, len);
+		m_large_missing = packet_size - len;
+		m_recv_begin += header_size + len;
+		return {};
+	}
+
+	if (buffered < frame_size)
+		return {};
+
+	StreamTail tail;
+	std::memcpy(&tail, frame + header_size + packet_size, sizeof(StreamTail));
+	if (!tail.ok())
+		throw NetworkException("Corrupted packet");
+
+	// the payload stays in the receive buffer, the packet only references it
+	std::shared_ptr<Packet> packet = std::allocate_shared<Packet>(PoolAllocator<Packet>(), IStream::Mode::DESERIALIZE, packet_type);
+	packet->append(m_recv_buffer, m_recv_begin + header_size, packet_size);
+
+	m_recv_begin += frame_size;
+	return packet;
+}
+
+bool gg::Connection::parseHeader(size_t& header_size, size_t& packet_size, IPacket::Type& packet_type) const
+{
+	size_t buffered = m_recv_end - m_recv_begin;
+	if (buffered < sizeof(StreamHeader))
+		return false;
+
+	const char* frame = m_recv_buffer.getData() + m_recv_begin;
+
+	StreamHeader head;
+	std::memcpy(&head, frame, sizeof(StreamHeader));
+	packet_type = head.packet_type;
+
+	if (head.packet_size < EXTENDED_SIZE)
+	{
+		header_size = sizeof(StreamHeader);
+		packet_size = head.packet_size;
+		return true;
+	}
+
+	if (buffered < sizeof(StreamHeader) + sizeof(uint32_t))
+		return false;
+
+	uint32_t extended_size;
+	std::memcpy(&extended_size, frame + sizeof(StreamHeader), sizeof(uint32_t));
+	header_size = sizeof(StreamHeader) + sizeof(uint32_t);
+	packet_size = extended_size;
+	return true;
+}
+
+bool gg::Connection::receiveData()
+{
+	if (m_large_packet && m_large_missing > 0)
+	{
+		size_t len = m_large_missing;
+		char* ptr = m_large_packet->reserve(len);
+		len = m_backend->read(ptr, len);
+		m_large_packet->commit(len);
+		m_large_missing -= len;
+		return (len > 0);
+	}
+
+	if (!m_recv_buffer)
+		m_recv_buffer = BufferPool::allocate(RECV_BUFFER_SIZE);
+
+	// received packets might still reference the parsed bytes, which can't be overwritten then
+	size_t buffered = m_recv_end - m_recv_begin;
+	size_t free_space = RECV_BUFFER_SIZE - m_recv_end;
+	if (isDatagram())
+	{
+		// a datagram is truncated if it doesn't fit, so each of them gets room for the largest one
+		if (free_space < MAX_DATAGRAM_SIZE)
+		{
+			if (m_recv_buffer.isShared())
+				m_recv_buffer = BufferPool::allocate(RECV_BUFFER_SIZE);
+
+			m_recv_end = 0;
+		}
+
+		// the unparsed bytes are the rest of an incomplete frame, which is never completed by the next datagram
+		m_recv_begin = m_recv_end;
+		if (buffered > 0)
+			throw NetworkException("Corrupted packet");
+	}
+	else if (free_space < RECV_BUFFER_SIZE / 4 || free_space < getMissingData())
+	{
+		if (m_recv_buffer.isShared())
+		{
+			Slab buffer = BufferPool::allocate(RECV_BUFFER_SIZE);
+			std::memcpy(buffer.getData(), m_recv_buffer.getData() + m_recv_begin, buffered);
+			m_recv_buffer = std::move(buffer);
+		}
+		else
+		{
+			std::memmove(m_recv_buffer.getData(), m_recv_buffer.getData() + m_recv_begin, buffered);
+		}
+
+		m_recv_begin = 0;
+		m_recv_end = buffered;
+	}
+	else if (buffered == 0 && !m_recv_buffer.isShared())
+	{
+		m_recv_begin = m_recv_end = 0;
+	}
+
+	size_t len = m_backend->read(m_recv_buffer.getData() + m_recv_end, RECV_BUFFER_SIZE - m_recv_end);
+	m_recv_end += len;
+	return (len > 0);
+}
+
+size_t gg::Connection::getMissingData() const
+{
+	size_t buffered = m_recv_end - m_recv_begin;
+
+	if (m_large_packet)
+	{
+		if (m_large_missing > 0)
+			return m_large_missing + sizeof(StreamTail);
+
+		return (buffered < sizeof(StreamTail)) ? (sizeof(StreamTail) - buffered) : 0;
+	}
+
+	size_t header_size;
+	size_t packet_size;
+	IPacket::Type packet_type;
+	if (!parseHeader(header_size, packet_size, packet_type))
+		return ((buffered < sizeof(StreamHeader)) ? sizeof(StreamHeader) : MAX_HEADER_SIZE) - buffered;
+
+	size_t frame_size = header_size + packet_size + sizeof(StreamTail);
+	return (frame_size > buffered) ? (frame_size - buffered) : 0;
+}
+
+size_t gg::Connection::buildHeader(const PacketPtr& packet, char* buffer) const
+{
+	size_t packet_size = packet->getSize();
+
 	StreamHeader head;
-	head.packet_size = static_cast<uint16_t>(packet->getSize());
+	head.packet_size = (packet_size < EXTENDED_SIZE) ? static_cast<uint16_t>(packet_size) : static_cast<uint16_t>(EXTENDED_SIZE);
 	head.packet_type = packet->getType();
 
+	std::memcpy(buffer, &head, sizeof(StreamHeader));
+	if (head.packet_size < EXTENDED_SIZE)
+		return sizeof(StreamHeader);
+
+	uint32_t extended_size = static_cast<uint32_t>(packet_size);
+	std::memcpy(buffer + sizeof(StreamHeader), &extended_size, sizeof(uint32_t));
+	return sizeof(StreamHeader) + sizeof(uint32_t);
+}
+
+size_t gg::Connection::buildFrame(const PacketPtr& packet, char* buffer) const
+{
+	size_t buffer_size = buildHeader(packet, buffer);
+
+	Packet* own_packet = dynamic_cast<Packet*>(packet.get());
+	if (own_packet)
+	{
+		for (size_t i = 0, count = own_packet->getSegmentCount(); i < count; ++i)
+		{
+			const Packet::Segment& segment = own_packet->getSegment(i);
+			std::memcpy(&buffer[buffer_size], segment.slab.getData() + segment.offset, segment.len);
+			buffer_size += segment.len;
+		}
+	}
+	else
+	{
+		std::memcpy(&buffer[buffer_size], packet->getData(), packet->getSize());
+		buffer_size += packet->getSize();
+	}
+
+	StreamTail tail;
+	std::memcpy(&buffer[buffer_size], &tail, sizeof(StreamTail));
+	buffer_size += sizeof(StreamTail);
+
+	return buffer_size;
+}
+
+bool gg::Connection::writeFrame(const PacketPtr& packet)
+{
+	// the size of a datagram is limited, the frame would be lost or the socket would report an error
+	if (isDatagram() && sizeof(StreamHeader) + packet->getSize() + sizeof(StreamTail) > MAX_DATAGRAM_SIZE)
+		return false;
+
+	m_frame.resize(MAX_HEADER_SIZE + packet->getSize() + sizeof(StreamTail));
+	size_t frame_size = buildFrame(packet, m_frame.data());
+	return (m_backend->write(m_frame.data(), frame_size) == frame_size);
+}
+
+void gg::Connection::queuePacket(const PacketPtr& packet)
+{
+	char head[MAX_HEADER_SIZE];
+	queueBytes(head, buildHeader(packet, head));
+
+	Packet* own_packet = dynamic_cast<Packet*>(packet.get());
+	if (own_packet)
+	{
+		for (size_t i = 0, count = own_packet->getSegmentCount(); i < count; ++i)
+		{
+			const Packet::Segment& segment = own_packet->getSegment(i);
+			queuePayload(packet, segment.slab.getData() + segment.offset, segment.len);
+		}
+	}
+	else
+	{
+		queuePayload(packet, packet->getData(), packet->getSize());
+	}
+
 	StreamTail tail;
+	queueBytes(reinterpret_cast<const char*>(&tail), sizeof(StreamTail));
+}
 
-	char buffer[Stream::BUF_SIZE + sizeof(StreamHeader) + sizeof(StreamTail)];
-	size_t buffer_size = 0;
-	std::memcpy(&buffer[buffer_size], &head, sizeof(StreamHeader));			buffer_size += sizeof(StreamHeader);
-	std::memcpy(&buffer[buffer_size], packet->getData(), head.packet_size); buffer_size += head.packet_size;
-	std::memcpy(&buffer[buffer_size], &tail, sizeof(StreamTail));			buffer_size += sizeof(StreamTail);
+void gg::Connection::queuePayload(const PacketPtr& packet, const char* ptr, size_t len)
+{
+	if (len < MIN_REFERENCED_SIZE)
+	{
+		queueBytes(ptr, len);
+		return;
+	}
 
-	//size_t bytes_written = 0;
-	//bytes_written += m_backend->write(reinterpret_cast<const char*>(&head), sizeof(StreamHeader));
-	//bytes_written += m_backend->write(packet->getData(), head.packet_size);
-	//bytes_written += m_backend->write(reinterpret_cast<const char*>(&tail), sizeof(StreamTail));
+	QueuedData data;
+	data.packet = packet;
+	data.ptr = ptr;
+	data.len = len;
+	m_send_queue.push_back(std::move(data));
+	m_queued_data += len;
+}
 
-	//return (bytes_written == head.packet_size + sizeof(StreamHeader) + sizeof(StreamTail));
+void gg::Connection::queueBytes(const char* ptr, size_t len)
+{
+	// consecutive small packets become a single buffer of the next write
+	if (m_send_queue.empty() || m_send_queue.back().packet)
+	{
+		QueuedData data;
+		data.ptr = nullptr;
+		data.len = 0;
+		m_send_queue.push_back(std::move(data));
+	}
 
-	return (m_backend->write(buffer, buffer_size) == buffer_size);
+	m_send_buffer.insert(m_send_buffer.end(), ptr, ptr + len);
+	m_send_queue.back().len += len;
+	m_queued_data += len;
+}
+
+bool gg::Connection::writeQueue()
+{
+	while (!m_send_queue.empty())
+	{
+		WriteBuffer buffers[ISocketBackend::MAX_WRITE_BUFFERS];
+		size_t count = 0;
+		size_t buffer_pos = m_send_buffer_begin;
+		size_t skip = m_send_offset;
+
+		for (auto& data : m_send_queue)
+		{
+			if (count == ISocketBackend::MAX_WRITE_BUFFERS)
+				break;
+
+			if (data.packet)
+			{
+				buffers[count].ptr = data.ptr + skip;
+			}
+			else
+			{
+				buffers[count].ptr = &m_send_buffer[buffer_pos]; // the written part is already skipped
+				buffer_pos += data.len - skip;
+			}
+
+			buffers[count].len = data.len - skip;
+			++count;
+			skip = 0;
+		}
+
+		size_t bytes_written = m_socket_backend->write(buffers, count);
+		if (bytes_written == 0)
+		{
+			if (m_backend->isAlive())
+			{
+				// the written part of the buffer is only dropped once it's the larger half
+				if (m_send_buffer_begin > m_send_buffer.size() / 2)
+				{
+					m_send_buffer.erase(m_send_buffer.begin(), m_send_buffer.begin() + m_send_buffer_begin);
+					m_send_buffer_begin = 0;
+				}
+
+				return true;
+			}
+
+			m_send_queue.clear();
+			m_send_buffer.clear();
+			m_send_buffer_begin = 0;
+			m_send_offset = 0;
+			m_queued_data = 0;
+			return false;
+		}
+
+		m_queued_data -= bytes_written;
+
+		// a partial write leaves the rest of the data for the next write
+		while (bytes_written > 0)
+		{
+			QueuedData& data = m_send_queue.front();
+			size_t len = data.len - m_send_offset;
+			if (len > bytes_written)
+				len = bytes_written;
+
+			if (!data.packet)
+				m_send_buffer_begin += len;
+
+			bytes_written -= len;
+			m_send_offset += len;
+
+			if (m_send_offset == data.len)
+			{
+				m_send_queue.pop_front();
+				m_send_offset = 0;
+			}
+		}
+	}
+
+	m_send_buffer.clear();
+	m_send_buffer_begin = 0;
+	return true;
+}
+
+bool gg::Connection::flushQueue(size_t max_queued_data, uint32_t timeoutMs)
+{
+	Timer timer;
+
+	for (;;)
+	{
+		if (!writeQueue())
+			return false;
+
+		if (m_queued_data <= max_queued_data)
+			return true;
+
+		uint64_t elapsed = timer.peekElapsed();
+		if (elapsed >= timeoutMs)
+			return false;
+
+		// only the non-blocking socket backends can leave packets in the queue
+		m_socket_backend->waitForWritable((timeoutMs == UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(timeoutMs - elapsed));
+	}
 }
 
 
@@ -321,14 +938,19 @@ gg::ServerPtr gg::NetworkManager::createServer(ServerBackendPtr&& backend) const
 	return ServerPtr( new Server(std::move(backend)) );
 }
 
+gg::ConnectionReactorPtr gg::NetworkManager::createReactor() const
+{
+	return ConnectionReactorPtr( new ConnectionReactor() );
+}
+
 std::shared_ptr<gg::IPacket> gg::NetworkManager::createPacket(IPacket::Type type) const
 {
-	return PacketPtr( new Packet(IStream::Mode::SERIALIZE, type) );
+	return std::allocate_shared<Packet>(PoolAllocator<Packet>(), IStream::Mode::SERIALIZE, type);
 }
 
 std::shared_ptr<gg::IPacket> gg::NetworkManager::createPacket(EventPtr event) const
 {
-	PacketPtr packet( new Packet(IStream::Mode::SERIALIZE, event->getType()) );
+	PacketPtr packet = std::allocate_shared<Packet>(PoolAllocator<Packet>(), IStream::Mode::SERIALIZE, event->getType());
 	event->serialize(*packet);
 	return packet;
 }
@@ -9,9 +9,12 @@
 #pragma once
 #pragma warning (disable : 4250)
 
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include "stream_impl.hpp"
+#include "bufferpool.hpp"
 #include "gg/network.hpp"
 
 namespace gg
@@ -19,27 +22,46 @@ namespace gg
 	class Packet : public Stream, public IPacket
 	{
 	public:
+		enum : size_t { MAX_SIZE = 16 * 1024 * 1024 }; // larger payloads are chained from several slabs
+
+		struct Segment
+		{
+			Slab slab;
+			size_t offset;
+			size_t len;
+		};
+
 		Packet(Mode mode, Type type);
 		virtual ~Packet();
 		virtual Type getType() const;
-		virtual const char* getData() const;
+		virtual const char* getData() const; // joins the segments into a copy if there are more of them
 		virtual size_t getSize() const;
 		virtual size_t write(const char* ptr, size_t len);
 		virtual size_t read(char* ptr, size_t len);
 
 		// for internal use
-		char* getDataPtr();
-		void setSize(size_t);
+		size_t getSegmentCount() const;
+		const Segment& getSegment(size_t) const;
+		void append(const Slab&, size_t offset, size_t len); // references the data without copying it
+		char* reserve(size_t& len); // free space after the data, 'len' is reduced to the available bytes
+		void commit(size_t len); // of the reserved bytes
 
 	protected:
-		char m_data[BUF_SIZE];
+		Segment m_first; // most packets fit in a single segment
+		std::vector<Segment> m_more;
 		size_t m_data_len;
-		size_t m_data_pos;
+		size_t m_read_segment;
+		size_t m_read_pos; // in the read segment
+		mutable std::unique_ptr<char[]> m_joined_data;
 
 	private:
 		Type m_type;
+
+		Segment& getLastSegment();
 	};
 
+	class ISocketBackend;
+
 	class Connection : public IConnection
 	{
 	public:
@@ -50,9 +72,15 @@ namespace gg
 		virtual bool isAlive() const;
 		virtual const std::string& getAddress() const;
 		virtual PacketPtr getNextPacket(uint32_t timeoutMs = 0);
+		virtual size_t getNextPackets(std::vector<PacketPtr>&, size_t max_packets, uint32_t timeoutMs = 0);
 		virtual PacketPtr createPacket(IPacket::Type) const;
 		virtual PacketPtr createPacket(EventPtr) const;
 		virtual bool send(PacketPtr);
+		virtual bool send(const std::vector<PacketPtr>&);
+		virtual bool flush(uint32_t timeoutMs = 0);
+
+		// for internal use
+		IConnectionBackend* getBackend() const;
 
 	private:
 		struct StreamHeader
@@ -67,8 +95,52 @@ namespace gg
 			bool ok() { return n == 0; }
 		};
 
+		enum : uint16_t { EXTENDED_SIZE = 0xFFFF }; // the real size of the packet follows the header as uint32_t
+		enum : size_t { MAX_HEADER_SIZE = sizeof(StreamHeader) + sizeof(uint32_t) };
+		enum : size_t { MAX_STACK_FRAME_SIZE = MAX_HEADER_SIZE + Stream::BUF_SIZE + sizeof(StreamTail) }; // larger frames are queued
+		enum : size_t { RECV_BUFFER_SIZE = BufferPool::MAX_SLAB_SIZE }; // larger frames are read right into their packet
+		enum : size_t { MAX_WAITED_DATA = 8 * 1024 }; // a socket buffer might not hold a whole large frame
+		enum : size_t { MAX_DATAGRAM_SIZE = 65507 }; // a frame never spans datagrams, this is the largest UDP payload
+		enum : size_t { MAX_QUEUED_DATA = 1024 * 1024 }; // send() blocks above it like a full socket buffer would
+		enum : size_t { MIN_REFERENCED_SIZE = 2048 }; // smaller payloads are copied next to their header and tail
+		enum : uint32_t { LINGER_TIMEOUT = 1000 }; // for queued packets on disconnect
+
+		struct QueuedData
+		{
+			PacketPtr packet; // holds the referenced payload, or nullptr for the next bytes of m_send_buffer
+			const char* ptr;
+			size_t len;
+		};
+
 		mutable std::recursive_mutex m_mutex;
 		ConnectionBackendPtr m_backend;
+		ISocketBackend* m_socket_backend; // nullptr if the backend can't be written without blocking
+		Slab m_recv_buffer; // allocated by the first receive, received packets reference it
+		size_t m_recv_begin; // first byte which is not parsed yet
+		size_t m_recv_end;
+		std::shared_ptr<Packet> m_large_packet; // doesn't fit in the receive buffer
+		size_t m_large_missing; // payload of the large packet which is not received yet
+		std::deque<QueuedData> m_send_queue; // only used by stream sockets, other backends are written right away
+		std::vector<char> m_send_buffer; // headers, tails and small payloads of the queue
+		size_t m_send_buffer_begin; // first byte which is not written yet
+		size_t m_send_offset; // bytes of the first queued data which are already written
+		size_t m_queued_data; // bytes left to write
+		std::vector<char> m_frame; // reused by writeFrame()
+
+		bool isDatagram() const;
+		PacketPtr readPacket(); // non-blocking, receives more data only if the buffer has no complete frame
+		PacketPtr parsePacket(); // the next complete frame of the buffer
+		bool parseHeader(size_t& header_size, size_t& packet_size, IPacket::Type& type) const; // false if the header is incomplete
+		bool receiveData(); // a single read from the backend, false if there was nothing to read
+		size_t getMissingData() const; // to complete the next frame
+		size_t buildHeader(const PacketPtr&, char* buffer) const; // the buffer should hold MAX_HEADER_SIZE bytes
+		size_t buildFrame(const PacketPtr&, char* buffer) const; // the buffer should hold the whole frame
+		bool writeFrame(const PacketPtr&); // blocking, for backends without a queue
+		void queuePacket(const PacketPtr&);
+		void queuePayload(const PacketPtr&, const char* ptr, size_t len);
+		void queueBytes(const char* ptr, size_t len);
+		bool writeQueue(); // non-blocking, false if the connection is lost
+		bool flushQueue(size_t max_queued_data, uint32_t timeoutMs);
 	};
 
 	class Server : public IServer
@@ -108,6 +180,7 @@ namespace gg
 		virtual ConnectionPtr createConnection(ConnectionBackendPtr&&) const;
 		virtual ServerPtr createServer(uint16_t port, bool tcp = true, bool ipv6 = false) const;
 		virtual ServerPtr createServer(ServerBackendPtr&&) const;
+		virtual ConnectionReactorPtr createReactor() const;
 		virtual PacketPtr createPacket(IPacket::Type) const;
 		virtual PacketPtr createPacket(EventPtr) const;
 	};
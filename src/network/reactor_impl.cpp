@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <thread>
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+#include "reactor_impl.hpp"
+
+
+gg::ConnectionReactor::ConnectionReactor()
+#ifndef _WIN32
+	: m_epoll(epoll_create1(EPOLL_CLOEXEC))
+#endif
+{
+}
+
+gg::ConnectionReactor::~ConnectionReactor()
+{
+#ifndef _WIN32
+	if (m_epoll != -1)
+		close(m_epoll);
+#endif
+}
+
+void gg::ConnectionReactor::addConnection(ConnectionPtr connection)
+{
+	if (!connection)
+		return;
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	IConnection* key = connection.get();
+	if (m_connections.find(key) != m_connections.end())
+		return;
+
+	Entry entry;
+	entry.connection = connection;
+	entry.backend = nullptr;
+	entry.socket = INVALID_SOCKET;
+	entry.ready = false;
+
+	// only the sockets of our own backends can be waited for
+	Connection* conn = dynamic_cast<Connection*>(key);
+	ISocketBackend* backend = conn ? dynamic_cast<ISocketBackend*>(conn->getBackend()) : nullptr;
+	SOCKET socket = backend ? backend->getSocket() : INVALID_SOCKET;
+
+	if (socket != INVALID_SOCKET)
+	{
+#ifdef _WIN32
+		entry.backend = backend;
+		entry.socket = socket;
+#else
+		epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = key;
+
+		if (m_epoll != -1 && epoll_ctl(m_epoll, EPOLL_CTL_ADD, socket, &ev) == 0)
+		{
+			entry.backend = backend;
+			entry.socket = socket;
+		}
+#endif
+	}
+
+	// packets might have arrived before the connection was added
+	if (entry.backend)
+	{
+		entry.ready = true;
+		m_ready.push_back(key);
+	}
+	else
+	{
+		m_polled.push_back(key);
+	}
+
+	m_connections.emplace(key, std::move(entry));
+}
+
+void gg::ConnectionReactor::removeConnection(ConnectionPtr connection)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	auto it = m_connections.find(connection.get());
+	if (it != m_connections.end())
+		unregister(it);
+}
+
+size_t gg::ConnectionReactor::getConnectionCount() const
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	return m_connections.size();
+}
+
+void gg::ConnectionReactor::addEventDefinition(const IEventDefinitionBase& definition)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_definitions[definition.getType()] = &definition;
+}
+
+void gg::ConnectionReactor::setPacketHandler(PacketHandler handler)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_packet_handler = std::move(handler);
+}
+
+void gg::ConnectionReactor::setEventHandler(EventHandler handler)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_event_handler = std::move(handler);
+}
+
+void gg::ConnectionReactor::setDisconnectHandler(DisconnectHandler handler)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_disconnect_handler = std::move(handler);
+}
+
+size_t gg::ConnectionReactor::poll(uint32_t timeoutMs)
+{
+	std::vector<Result> results;
+	PacketHandler packet_handler;
+	EventHandler event_handler;
+	DisconnectHandler disconnect_handler;
+	size_t packet_count = 0;
+
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+		// there is no waiting if a connection has packets left from the last poll or it can't be waited for
+		waitForSockets((m_ready.empty() && m_polled.empty()) ? timeoutMs : 0);
+
+		std::vector<IConnection*> ready;
+		ready.swap(m_ready);
+		ready.insert(ready.end(), m_polled.begin(), m_polled.end());
+
+		for (IConnection* key : ready)
+		{
+			auto it = m_connections.find(key);
+			if (it == m_connections.end())
+				continue;
+
+			Entry& entry = it->second;
+			entry.ready = false;
+
+			Result result;
+			result.connection = entry.connection;
+			result.disconnected = false;
+
+			if (!readPackets(entry, result) && entry.backend)
+			{
+				entry.ready = true;
+				m_ready.push_back(key);
+			}
+
+			if (result.disconnected)
+				unregister(it);
+
+			if (result.disconnected || !result.packets.empty() || !result.events.empty())
+			{
+				packet_count += result.packets.size() + result.events.size();
+				results.push_back(std::move(result));
+			}
+		}
+
+		packet_handler = m_packet_handler;
+		event_handler = m_event_handler;
+		disconnect_handler = m_disconnect_handler;
+	}
+
+	// handlers are free to add or remove connections
+	for (auto& result : results)
+	{
+		if (packet_handler)
+		{
+			for (auto& packet : result.packets)
+				packet_handler(result.connection, packet);
+		}
+
+		if (event_handler && !result.events.empty())
+			event_handler(result.connection, result.events);
+
+		if (disconnect_handler && result.disconnected)
+			disconnect_handler(result.connection);
+	}
+
+	return packet_count;
+}
+
+void gg::ConnectionReactor::waitForSockets(uint32_t timeoutMs)
+{
+	auto sleep = [timeoutMs]()
+	{
+		if (timeoutMs > 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+	};
+
+	int timeout = (timeoutMs > INT_MAX) ? INT_MAX : static_cast<int>(timeoutMs);
+
+#ifdef _WIN32
+	// WSAPoll is level-triggered, connections with leftover data are reported again.
+	// WinSock sockets are blocking, so send() never leaves packets to flush on writability.
+	std::vector<WSAPOLLFD> fds;
+	std::vector<IConnection*> keys;
+
+	for (auto& it : m_connections)
+	{
+		if (it.second.backend && it.second.backend->getSocket() != INVALID_SOCKET)
+		{
+			WSAPOLLFD fd = {};
+			fd.fd = it.second.backend->getSocket();
+			fd.events = POLLRDNORM;
+			fds.push_back(fd);
+			keys.push_back(it.first);
+		}
+	}
+
+	if (fds.empty())
+	{
+		sleep();
+		return;
+	}
+
+	if (WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout) <= 0)
+		return;
+
+	for (size_t i = 0; i < fds.size(); ++i)
+	{
+		if (fds[i].revents == 0)
+			continue;
+
+		Entry& entry = m_connections[keys[i]];
+		if (!entry.ready)
+		{
+			entry.ready = true;
+			m_ready.push_back(keys[i]);
+		}
+	}
+#else
+	if (m_epoll == -1 || m_connections.size() == m_polled.size())
+	{
+		sleep();
+		return;
+	}
+
+	epoll_event events[MAX_READY_SOCKETS];
+	int count = epoll_wait(m_epoll, events, MAX_READY_SOCKETS, timeout);
+
+	for (int i = 0; i < count; ++i)
+	{
+		IConnection* key = static_cast<IConnection*>(events[i].data.ptr);
+
+		auto it = m_connections.find(key);
+		if (it == m_connections.end())
+			continue;
+
+		// the packets queued by send() are flushed as soon as there's room for them
+		if (events[i].events & EPOLLOUT)
+			it->second.connection->flush(0);
+
+		if ((events[i].events & ~EPOLLOUT) && !it->second.ready)
+		{
+			it->second.ready = true;
+			m_ready.push_back(key);
+		}
+	}
+#endif // _WIN32
+}
+
+bool gg::ConnectionReactor::readPackets(Entry& entry, Result& result)
+{
+	m_packets.clear();
+
+	try
+	{
+		entry.connection->getNextPackets(m_packets, MAX_PACKETS_PER_CONNECTION);
+	}
+	catch (INetworkException&)
+	{
+		entry.connection->disconnect();
+		result.disconnected = true;
+		return true;
+	}
+
+	for (auto& packet : m_packets)
+	{
+		auto definition = m_definitions.find(packet->getType());
+		if (definition == m_definitions.end())
+		{
+			result.packets.push_back(std::move(packet));
+			continue;
+		}
+
+		try
+		{
+			EventPtr event = (*definition->second)(*packet);
+			if (event)
+				result.events.push_back(std::move(event));
+		}
+		catch (ISerializationError&)
+		{
+		}
+	}
+
+	if (m_packets.size() == MAX_PACKETS_PER_CONNECTION)
+		return false;
+
+	// a partial packet is completed by new data, which triggers the socket again
+	result.disconnected = !entry.connection->isAlive();
+	return true;
+}
+
+void gg::ConnectionReactor::unregister(ConnectionMap::iterator it)
+{
+	Entry& entry = it->second;
+
+	if (entry.backend)
+	{
+#ifndef _WIN32
+		// a closed socket has already left the epoll set, and its descriptor might belong to someone else now
+		if (entry.backend->getSocket() == entry.socket)
+			epoll_ctl(m_epoll, EPOLL_CTL_DEL, entry.socket, nullptr);
+#endif
+	}
+	else
+	{
+		m_polled.erase(std::remove(m_polled.begin(), m_polled.end(), it->first), m_polled.end());
+	}
+
+	m_connections.erase(it);
+}
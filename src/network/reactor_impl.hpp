@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "backend_impl.hpp"
+
+namespace gg
+{
+	class ConnectionReactor : public IConnectionReactor
+	{
+	public:
+		ConnectionReactor();
+		virtual ~ConnectionReactor();
+		virtual void addConnection(ConnectionPtr);
+		virtual void removeConnection(ConnectionPtr);
+		virtual size_t getConnectionCount() const;
+		virtual void addEventDefinition(const IEventDefinitionBase&);
+		virtual void setPacketHandler(PacketHandler);
+		virtual void setEventHandler(EventHandler);
+		virtual void setDisconnectHandler(DisconnectHandler);
+		virtual size_t poll(uint32_t timeoutMs = 0);
+
+	private:
+		enum : size_t { MAX_PACKETS_PER_CONNECTION = 64 }; // in a single poll, so a busy connection can't starve the others
+		enum : size_t { MAX_READY_SOCKETS = 256 }; // fetched by a single wait
+
+		struct Entry
+		{
+			ConnectionPtr connection;
+			ISocketBackend* backend; // nullptr if the connection is polled one by one
+			SOCKET socket; // as it was registered
+			bool ready; // listed in m_ready
+		};
+
+		struct Result // delivered after the mutex is released
+		{
+			ConnectionPtr connection;
+			std::vector<PacketPtr> packets;
+			std::vector<EventPtr> events;
+			bool disconnected;
+		};
+
+		typedef std::unordered_map<IConnection*, Entry> ConnectionMap;
+
+		mutable std::recursive_mutex m_mutex;
+		ConnectionMap m_connections;
+		std::vector<IConnection*> m_ready; // sockets which might have unread data, removed entries are skipped
+		std::vector<IConnection*> m_polled;
+		std::unordered_map<IPacket::Type, const IEventDefinitionBase*> m_definitions;
+		std::vector<PacketPtr> m_packets; // reused by readPackets()
+		PacketHandler m_packet_handler;
+		EventHandler m_event_handler;
+		DisconnectHandler m_disconnect_handler;
+#ifndef _WIN32
+		int m_epoll; // edge-triggered, -1 if every connection is polled
+#endif
+
+		void waitForSockets(uint32_t timeoutMs); // adds the sockets with new data to m_ready
+		bool readPackets(Entry&, Result&); // returns false if the packet budget of the connection ran out
+		void unregister(ConnectionMap::iterator);
+	};
+};
@@ -6,9 +6,11 @@
  * All rights reserved.
  */
 
+#include <atomic>
 #include <cstdint>
 #include <locale>
 #include <set>
+#include "gg/thread.hpp"
 #include "Doboz/Decompressor.h"
 #include "encoder.hpp"
 #include "resource_impl.hpp"
@@ -428,14 +430,21 @@ bool gg::ResourceCreator::addDirectory(const std::wstring& dir_path)
 	if (!collectFiles(dir, files))
 		return false;
 
+	// 'convert' is not thread-safe
+	std::vector<std::string> res_file_names;
+	res_file_names.reserve(files.size());
 	for (auto& f : files)
+		res_file_names.push_back(convert.to_bytes(f.substr(dir.size() + 1)));
+
+	// files are compressed in parallel, so they end up in the archive in random order
+	std::atomic<bool> success(true);
+	gg::threadmgr.parallelFor(0, files.size(), [&](size_t i)
 	{
-		std::string res_file_name = convert.to_bytes(f.substr(dir.size() + 1));
-		if (!addFile(f, res_file_name))
-			return false;
-	}
+		if (!addFile(files[i], res_file_names[i]))
+			success = false;
+	}, 1);
 
-	return true;
+	return success;
 }
 
 bool gg::ResourceCreator::addFileData(const std::string& res_file_name, const std::vector<char>& data)
@@ -448,7 +457,9 @@ bool gg::ResourceCreator::addFileData(const std::string& res_file_name, const st
 	buffer.resize(compressed_size);
 
 	// compress data
-	m_compressor.compress(&data[0], orig_size, &buffer[0], buffer.size(), compressed_size);
+	auto compressor = acquireCompressor();
+	compressor->compress(&data[0], orig_size, &buffer[0], buffer.size(), compressed_size);
+	releaseCompressor(std::move(compressor));
 
 	// encrypt file name
 	std::vector<unsigned char> name;
@@ -476,6 +487,24 @@ bool gg::ResourceCreator::addFileData(const std::string& res_file_name, const st
 	return static_cast<bool>(m_file);
 }
 
+std::unique_ptr<doboz::Compressor> gg::ResourceCreator::acquireCompressor()
+{
+	std::lock_guard<decltype(m_compressors_mutex)> guard(m_compressors_mutex);
+
+	if (m_compressors.empty())
+		return std::unique_ptr<doboz::Compressor>(new doboz::Compressor());
+
+	auto compressor = std::move(m_compressors.back());
+	m_compressors.pop_back();
+	return compressor;
+}
+
+void gg::ResourceCreator::releaseCompressor(std::unique_ptr<doboz::Compressor> compressor)
+{
+	std::lock_guard<decltype(m_compressors_mutex)> guard(m_compressors_mutex);
+	m_compressors.push_back(std::move(compressor));
+}
+
 
 
 gg::FileSerializer::FileSerializer()
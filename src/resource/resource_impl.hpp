@@ -12,7 +12,9 @@
 #include <cstring>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <vector>
 #include "Doboz/Compressor.h"
 #include "stream_impl.hpp"
 #include "gg/resource.hpp"
@@ -92,11 +94,14 @@ namespace gg
 		ResourceCreator(const std::string& res_path, bool append_mode);
 		virtual bool init();
 		bool collectFiles(std::wstring dir_name, std::vector<std::wstring>& files);
+		std::unique_ptr<doboz::Compressor> acquireCompressor();
+		void releaseCompressor(std::unique_ptr<doboz::Compressor>);
 
 		mutable std::mutex m_mutex;
 		std::weak_ptr<ResourceCreator> m_self_ptr;
 		std::ofstream m_file;
-		doboz::Compressor m_compressor;
+		std::mutex m_compressors_mutex;
+		std::vector<std::unique_ptr<doboz::Compressor>> m_compressors; // idle ones, each is ~20 MB
 	};
 
 	class FileSerializer : public IFileSerializer
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include "eventqueue.hpp"
+
+gg::EventQueue::EventQueue() :
+	m_limit(0),
+	m_policy(EventOverflowPolicy::BLOCK),
+	m_first(0),
+	m_end(0),
+	m_waiting(0),
+	m_closed(false),
+	m_dropped(0),
+	m_coalesced(0)
+{
+}
+
+gg::EventQueue::~EventQueue()
+{
+}
+
+void gg::EventQueue::setLimit(size_t limit, EventOverflowPolicy policy)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	m_limit = limit;
+	m_policy = policy;
+	m_ring.clear();
+	m_ring.resize(limit);
+	m_first = 0;
+	m_end = 0;
+	m_last_of_type.clear();
+}
+
+void gg::EventQueue::push(EventPtr event, bool may_block)
+{
+	if (m_limit == 0)
+	{
+		m_queue.push(std::move(event));
+		return;
+	}
+
+	std::unique_lock<decltype(m_mutex)> lock(m_mutex);
+	pushLocked(std::move(event), lock, may_block);
+}
+
+void gg::EventQueue::push(const EventPtr* events, size_t count, bool may_block)
+{
+	if (m_limit == 0)
+	{
+		m_queue.push(events, events + count);
+		return;
+	}
+
+	std::unique_lock<decltype(m_mutex)> lock(m_mutex);
+	for (size_t i = 0; i < count; ++i)
+		pushLocked(EventPtr(events[i]), lock, may_block);
+}
+
+size_t gg::EventQueue::pop(std::vector<EventPtr>& events, size_t max_events)
+{
+	size_t n = 0;
+
+	if (m_limit == 0)
+	{
+		EventPtr event;
+		while ((max_events == 0 || n < max_events) && m_queue.pop(event))
+		{
+			events.push_back(std::move(event));
+			++n;
+		}
+
+		return n;
+	}
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	while ((max_events == 0 || n < max_events) && m_first != m_end)
+	{
+		if (m_policy == EventOverflowPolicy::COALESCE)
+			forget(m_first);
+
+		events.push_back(std::move(m_ring[m_first % m_limit]));
+		++m_first;
+		++n;
+	}
+
+	if (n > 0 && m_waiting > 0)
+		m_not_full.notify_all();
+
+	return n;
+}
+
+bool gg::EventQueue::empty() const
+{
+	if (m_limit == 0)
+		return m_queue.empty();
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	return (m_first == m_end);
+}
+
+void gg::EventQueue::close()
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_closed = true;
+	m_not_full.notify_all();
+}
+
+void gg::EventQueue::open()
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_closed = false;
+}
+
+uint64_t gg::EventQueue::getDroppedCount() const
+{
+	return m_dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t gg::EventQueue::getCoalescedCount() const
+{
+	return m_coalesced.load(std::memory_order_relaxed);
+}
+
+void gg::EventQueue::pushLocked(EventPtr&& event, std::unique_lock<std::mutex>& lock, bool may_block)
+{
+	// coalescing only kicks in once the lane is full, until then every event is kept
+	if (m_policy == EventOverflowPolicy::COALESCE && m_end - m_first >= m_limit)
+	{
+		auto it = m_last_of_type.find(event->getType());
+		if (it != m_last_of_type.end())
+		{
+			m_ring[it->second % m_limit] = std::move(event);
+			m_coalesced.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	if (m_end - m_first >= m_limit)
+	{
+		switch (m_policy)
+		{
+		case EventOverflowPolicy::BLOCK:
+			if (may_block)
+			{
+				++m_waiting;
+				m_not_full.wait(lock, [this] { return (m_end - m_first < m_limit || m_closed); });
+				--m_waiting;
+			}
+
+			if (m_end - m_first < m_limit)
+				break;
+
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+
+		case EventOverflowPolicy::DROP_OLDEST:
+			m_ring[m_first % m_limit].reset();
+			++m_first;
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			break;
+
+		default:
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	if (m_policy == EventOverflowPolicy::COALESCE)
+		m_last_of_type[event->getType()] = m_end;
+
+	m_ring[m_end % m_limit] = std::move(event);
+	++m_end;
+}
+
+void gg::EventQueue::forget(uint64_t seq)
+{
+	auto it = m_last_of_type.find(m_ring[seq % m_limit]->getType());
+	if (it != m_last_of_type.end() && it->second == seq)
+		m_last_of_type.erase(it);
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Event lane of a thread. Unlimited lanes are lock-free MPSC queues, limited
+ * lanes are ring buffers guarded by a mutex which apply an overflow policy
+ * once they are full. Only the owner thread is allowed to pop events.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "mpscqueue.hpp"
+#include "gg/thread.hpp"
+
+namespace gg
+{
+	class EventQueue
+	{
+	public:
+		EventQueue();
+		~EventQueue();
+		void setLimit(size_t limit, EventOverflowPolicy); // has to be called before the first push
+		void push(EventPtr event, bool may_block);
+		void push(const EventPtr* events, size_t count, bool may_block);
+		size_t pop(std::vector<EventPtr>& events, size_t max_events); // 0: no limit
+		bool empty() const; // only reliable on the consumer side
+		void close(); // the consumer stopped, blocked senders drop their events
+		void open();
+		uint64_t getDroppedCount() const;
+		uint64_t getCoalescedCount() const;
+
+	private:
+		size_t m_limit;
+		EventOverflowPolicy m_policy;
+		MPSCQueue<EventPtr> m_queue; // used if there is no limit
+
+		mutable std::mutex m_mutex;
+		std::condition_variable m_not_full;
+		std::vector<EventPtr> m_ring;
+		uint64_t m_first; // sequence number of the oldest queued event
+		uint64_t m_end; // sequence number of the next event
+		std::unordered_map<IEvent::Type, uint64_t> m_last_of_type; // sequence numbers (COALESCE only)
+		unsigned m_waiting;
+		bool m_closed;
+
+		std::atomic<uint64_t> m_dropped;
+		std::atomic<uint64_t> m_coalesced;
+
+		void pushLocked(EventPtr&& event, std::unique_lock<std::mutex>& lock, bool may_block);
+		void forget(uint64_t seq); // removes the event from m_last_of_type
+	};
+};
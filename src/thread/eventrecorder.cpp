@@ -0,0 +1,259 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "eventrecorder.hpp"
+
+static const char MAGIC[4] = { 'g', 'g', 'e', 'v' };
+static const char VERSION = 1;
+
+static void writeVarint(std::string& out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+
+	out.push_back(static_cast<char>(value));
+}
+
+static bool readVarint(std::istream& in, uint64_t& value)
+{
+	value = 0;
+
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		int byte = in.get();
+		if (byte == std::char_traits<char>::eof())
+			return false;
+
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+
+gg::EventBuffer::EventBuffer(Mode mode) :
+	Stream(mode),
+	m_read_pos(0)
+{
+}
+
+gg::EventBuffer::~EventBuffer()
+{
+}
+
+void gg::EventBuffer::clear()
+{
+	m_data.clear();
+	m_read_pos = 0;
+}
+
+std::string& gg::EventBuffer::getData()
+{
+	return m_data;
+}
+
+size_t gg::EventBuffer::write(const char* buf, size_t len)
+{
+	m_data.append(buf, len);
+	return len;
+}
+
+size_t gg::EventBuffer::read(char* buf, size_t len)
+{
+	len = std::min(len, m_data.size() - m_read_pos);
+	std::memcpy(buf, m_data.data() + m_read_pos, len);
+	m_read_pos += len;
+	return len;
+}
+
+
+gg::EventRecorder::EventRecorder(const std::string& file) :
+	m_file(file, std::ios::out | std::ios::binary | std::ios::trunc),
+	m_empty(true),
+	m_params(IStream::Mode::SERIALIZE)
+{
+	m_file.write(MAGIC, sizeof(MAGIC));
+	m_file.put(VERSION);
+}
+
+gg::EventRecorder::~EventRecorder()
+{
+	flush();
+}
+
+bool gg::EventRecorder::isOpen() const
+{
+	return m_file.good();
+}
+
+void gg::EventRecorder::record(const std::vector<EventPtr>& events)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	// events of a batch arrived at the same time, the recording starts at the first one
+	auto now = std::chrono::steady_clock::now();
+	uint64_t delta = m_empty ? 0 : std::chrono::duration_cast<std::chrono::microseconds>(now - m_last_time).count();
+	m_last_time = now;
+	m_empty = false;
+
+	m_record.clear();
+
+	for (auto& event : events)
+	{
+		m_params.clear();
+		try
+		{
+			event->serialize(m_params);
+		}
+		catch (ISerializationError&)
+		{
+			m_params.clear();
+		}
+
+		IEvent::Type type = event->getType();
+		m_record.push_back(static_cast<char>(type & 0xff));
+		m_record.push_back(static_cast<char>(type >> 8));
+		writeVarint(m_record, delta);
+		writeVarint(m_record, m_params.getData().size());
+		m_record += m_params.getData();
+
+		delta = 0;
+	}
+
+	m_file.write(m_record.data(), m_record.size());
+}
+
+void gg::EventRecorder::flush()
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_file.flush();
+}
+
+
+gg::EventReplayer::EventReplayer(const std::string& file, ThreadPtr target,
+	std::vector<const IEventDefinitionBase*> definitions, double speed) :
+	m_file(file, std::ios::in | std::ios::binary),
+	m_target(target),
+	m_speed(speed),
+	m_started(false),
+	m_has_record(false),
+	m_record_type(0),
+	m_record_time(0),
+	m_params(IStream::Mode::DESERIALIZE)
+{
+	for (auto definition : definitions)
+		m_definitions[definition->getType()] = definition;
+
+	char magic[sizeof(MAGIC)] = {};
+	m_file.read(magic, sizeof(magic));
+	if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || m_file.get() != VERSION)
+		m_file.setstate(std::ios::failbit);
+}
+
+gg::EventReplayer::~EventReplayer()
+{
+}
+
+void gg::EventReplayer::onStart(ITaskOptions&)
+{
+}
+
+void gg::EventReplayer::onEvent(ITaskOptions&, EventPtr)
+{
+}
+
+void gg::EventReplayer::onUpdate(ITaskOptions& options)
+{
+	// the timing is relative to the first update, onStart might run way before it
+	auto now = std::chrono::steady_clock::now();
+	if (!m_started)
+	{
+		m_start_time = now;
+		m_started = true;
+	}
+
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_start_time).count();
+	uint32_t wait_ms = 0;
+
+	while (m_events.size() < MAX_BATCH_SIZE && (m_has_record || readRecord()))
+	{
+		uint64_t due = (m_speed > 0) ? static_cast<uint64_t>(m_record_time / m_speed) : 0;
+		if (due > elapsed)
+		{
+			wait_ms = static_cast<uint32_t>((due - elapsed + 999) / 1000);
+			break;
+		}
+
+		EventPtr event = createEvent();
+		if (event)
+			m_events.push_back(std::move(event));
+
+		m_has_record = false;
+	}
+
+	if (!m_events.empty())
+	{
+		m_target->sendEvents(m_events);
+		m_events.clear();
+	}
+
+	if (m_has_record || m_file.good())
+		options.setUpdateInterval(wait_ms);
+	else
+		options.finish();
+}
+
+bool gg::EventReplayer::readRecord()
+{
+	char type[2];
+	uint64_t delta;
+	uint64_t size;
+
+	if (!m_file.read(type, sizeof(type)) || !readVarint(m_file, delta) || !readVarint(m_file, size))
+	{
+		m_file.setstate(std::ios::failbit);
+		return false;
+	}
+
+	m_params.clear();
+	m_params.getData().resize(static_cast<size_t>(size));
+	if (size > 0 && !m_file.read(&m_params.getData()[0], size))
+		return false;
+
+	m_record_type = static_cast<IEvent::Type>(static_cast<uint8_t>(type[0]) | (static_cast<uint8_t>(type[1]) << 8));
+	m_record_time += delta;
+	m_has_record = true;
+	return true;
+}
+
+gg::EventPtr gg::EventReplayer::createEvent()
+{
+	const IEventDefinitionBase* definition;
+
+	auto it = m_definitions.find(m_record_type);
+	if (it != m_definitions.end())
+		definition = it->second;
+	else
+		definition = getEventTypes().getDefinition(m_record_type);
+
+	if (!definition)
+		return {};
+
+	// events without serialized parameters (eg. local events) are default constructed
+	if (m_params.getData().empty())
+		return (*definition)();
+	else
+		return (*definition)(m_params);
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Recording format:
+ *
+ * header: "ggev" + version (uint8)
+ * record: type (uint16) + time since previous record in us (varint) +
+ *         size of parameters (varint) + parameters serialized by IEvent
+ *
+ * Varints store 7 bits per byte, the highest bit marks a following byte.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "stream_impl.hpp"
+#include "gg/thread.hpp"
+
+namespace gg
+{
+	class EventBuffer : public Stream
+	{
+	public:
+		EventBuffer(Mode);
+		virtual ~EventBuffer();
+		void clear();
+		std::string& getData();
+		virtual size_t write(const char* buf, size_t len);
+		virtual size_t read(char* buf, size_t len);
+
+	private:
+		std::string m_data;
+		size_t m_read_pos;
+	};
+
+	class EventRecorder : public IEventRecorder
+	{
+	public:
+		EventRecorder(const std::string& file);
+		virtual ~EventRecorder();
+		bool isOpen() const;
+		virtual void record(const std::vector<EventPtr>&);
+		virtual void flush();
+
+	private:
+		std::mutex m_mutex;
+		std::ofstream m_file;
+		bool m_empty;
+		std::chrono::steady_clock::time_point m_last_time;
+		EventBuffer m_params;
+		std::string m_record;
+	};
+
+	class EventReplayer : public ITask
+	{
+	public:
+		EventReplayer(const std::string& file, ThreadPtr target,
+			std::vector<const IEventDefinitionBase*> definitions, double speed);
+		virtual ~EventReplayer();
+		virtual void onStart(ITaskOptions&);
+		virtual void onEvent(ITaskOptions&, EventPtr);
+		virtual void onUpdate(ITaskOptions&);
+
+	private:
+		enum : size_t { MAX_BATCH_SIZE = 1000 }; // events sent in a single update
+
+		std::ifstream m_file;
+		ThreadPtr m_target;
+		std::unordered_map<IEvent::Type, const IEventDefinitionBase*> m_definitions;
+		double m_speed;
+		bool m_started;
+		std::chrono::steady_clock::time_point m_start_time;
+		bool m_has_record; // the next record is read but not sent yet
+		IEvent::Type m_record_type;
+		uint64_t m_record_time; // since the start of the recording in us
+		EventBuffer m_params;
+		std::vector<EventPtr> m_events;
+
+		bool readRecord();
+		EventPtr createEvent();
+	};
+};
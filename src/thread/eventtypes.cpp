@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include "eventtypes.hpp"
+
+gg::EventTypeRegistry::EventTypeRegistry() :
+	m_count(0)
+{
+	for (auto& id : m_ids)
+		id.store(0, std::memory_order_relaxed);
+}
+
+gg::EventTypeRegistry::~EventTypeRegistry()
+{
+}
+
+gg::IEventTypeRegistry::ID gg::EventTypeRegistry::registerDefinition(
+	const IEventDefinitionBase& definition, const std::type_info& event_class, const char* name)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	IEvent::Type type = definition.getType();
+	Entry& entry = m_entries[type];
+
+	if (entry.event_class && *entry.event_class != event_class)
+	{
+		throw EventTypeCollision("event type " + std::to_string(type) + " is defined as "
+			+ entry.event_class->name() + " and " + event_class.name());
+	}
+
+	if (name && !entry.name.empty() && entry.name != name)
+	{
+		throw EventTypeCollision("event type " + std::to_string(type) + " is defined as '"
+			+ entry.name + "' and '" + name + "'");
+	}
+
+	// the same event can be defined in more than one module
+	entry.event_class = &event_class;
+	if (name)
+		entry.name = name;
+	entry.definitions.push_back(&definition);
+
+	return addID(type);
+}
+
+void gg::EventTypeRegistry::unregisterDefinition(const IEventDefinitionBase& definition)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	// the type keeps its ID, it might still be used by subscriptions or events in flight
+	auto it = m_entries.find(definition.getType());
+	if (it == m_entries.end())
+		return;
+
+	auto& definitions = it->second.definitions;
+	definitions.erase(std::remove(definitions.begin(), definitions.end(), &definition), definitions.end());
+
+	if (definitions.empty())
+	{
+		it->second.event_class = nullptr;
+		it->second.name.clear();
+	}
+}
+
+gg::IEventTypeRegistry::ID gg::EventTypeRegistry::getID(IEvent::Type type) const
+{
+	return findID(type);
+}
+
+size_t gg::EventTypeRegistry::getCount() const
+{
+	return m_count.load(std::memory_order_acquire);
+}
+
+const gg::IEventDefinitionBase* gg::EventTypeRegistry::getDefinition(IEvent::Type type) const
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	auto it = m_entries.find(type);
+	if (it == m_entries.end() || it->second.definitions.empty())
+		return nullptr;
+
+	return it->second.definitions.front();
+}
+
+gg::IEventTypeRegistry::ID gg::EventTypeRegistry::getOrAddID(IEvent::Type type)
+{
+	ID id = findID(type);
+	if (id != INVALID_ID)
+		return id;
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	return addID(type);
+}
+
+gg::IEventTypeRegistry::ID gg::EventTypeRegistry::addID(IEvent::Type type)
+{
+	uint16_t id = m_ids[type].load(std::memory_order_relaxed);
+	if (id != 0)
+		return static_cast<ID>(id - 1);
+
+	size_t count = m_count.load(std::memory_order_relaxed);
+	if (count >= INVALID_ID)
+		throw std::length_error("too many event types");
+
+	m_ids[type].store(static_cast<uint16_t>(count + 1), std::memory_order_release);
+	m_count.store(count + 1, std::memory_order_release);
+	return static_cast<ID>(count);
+}
@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#include "gg/event.hpp"
+
+namespace gg
+{
+	class EventTypeRegistry : public IEventTypeRegistry
+	{
+	public:
+		EventTypeRegistry();
+		virtual ~EventTypeRegistry();
+		virtual ID registerDefinition(const IEventDefinitionBase&, const std::type_info& event_class, const char* name);
+		virtual void unregisterDefinition(const IEventDefinitionBase&);
+		virtual ID getID(IEvent::Type) const;
+		virtual size_t getCount() const;
+		virtual const IEventDefinitionBase* getDefinition(IEvent::Type) const;
+
+		// types can be subscribed to without having a definition, they get an ID as well
+		ID getOrAddID(IEvent::Type);
+
+		ID findID(IEvent::Type type) const // lock-free version of getID()
+		{
+			return static_cast<ID>(m_ids[type].load(std::memory_order_acquire) - 1);
+		}
+
+	private:
+		struct Entry
+		{
+			const std::type_info* event_class = nullptr;
+			std::string name;
+			std::vector<const IEventDefinitionBase*> definitions;
+		};
+
+		mutable std::mutex m_mutex;
+		std::unordered_map<IEvent::Type, Entry> m_entries;
+		std::atomic<uint16_t> m_ids[UINT16_MAX + 1]; // ID + 1 of every type, 0 if the type has no ID
+		std::atomic<size_t> m_count;
+
+		ID addID(IEvent::Type); // requires the mutex to be locked
+	};
+};
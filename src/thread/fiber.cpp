@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#ifdef _WIN32
+#	include <Windows.h>
+#else
+#	include <ucontext.h>
+#endif
+#include "fiber.hpp"
+
+#ifdef _WIN32
+struct gg::Fiber::Context
+{
+	LPVOID fiber = nullptr;
+	LPVOID caller = nullptr;
+	bool converted_caller = false;
+};
+#else
+struct gg::Fiber::Context
+{
+	ucontext_t fiber;
+	ucontext_t caller;
+	std::vector<char> stack;
+};
+
+static const size_t DEFAULT_STACK_SIZE = 256 * 1024;
+#endif
+
+
+gg::Fiber::Fiber(std::function<void()> func, size_t stack_size) :
+	m_func(std::move(func)),
+	m_context(new Context()),
+	m_running(false),
+	m_finished(false),
+	m_cancelled(false)
+{
+#ifdef _WIN32
+	m_context->fiber = CreateFiber(stack_size, &Fiber::fiberEntry, this);
+	if (!m_context->fiber)
+		throw std::runtime_error("CreateFiber failed");
+#else
+	m_context->stack.resize(stack_size ? stack_size : DEFAULT_STACK_SIZE);
+
+	getcontext(&m_context->fiber);
+	m_context->fiber.uc_stack.ss_sp = m_context->stack.data();
+	m_context->fiber.uc_stack.ss_size = m_context->stack.size();
+	m_context->fiber.uc_link = nullptr;
+
+	// makecontext only passes int arguments
+	uintptr_t self = reinterpret_cast<uintptr_t>(this);
+	makecontext(&m_context->fiber, reinterpret_cast<void(*)()>(&Fiber::fiberEntry), 2,
+		static_cast<unsigned>(static_cast<uint64_t>(self) >> 32), static_cast<unsigned>(self & 0xffffffff));
+#endif
+}
+
+gg::Fiber::~Fiber()
+{
+	// unwind the stack of the suspended function
+	if (m_running && !m_finished)
+	{
+		m_cancelled = true;
+		switchToFiber();
+	}
+
+#ifdef _WIN32
+	DeleteFiber(m_context->fiber);
+#endif
+}
+
+void gg::Fiber::resume()
+{
+	if (m_finished)
+		return;
+
+	m_running = true;
+	switchToFiber();
+
+	if (m_error)
+	{
+		std::exception_ptr error;
+		std::swap(error, m_error);
+		std::rethrow_exception(error);
+	}
+}
+
+void gg::Fiber::yield()
+{
+	switchToCaller();
+
+	if (m_cancelled)
+		throw FiberCancelled();
+}
+
+bool gg::Fiber::isFinished() const
+{
+	return m_finished;
+}
+
+void gg::Fiber::entry()
+{
+	if (!m_cancelled)
+	{
+		try
+		{
+			m_func();
+		}
+		catch (FiberCancelled&)
+		{
+		}
+		catch (...)
+		{
+			m_error = std::current_exception();
+		}
+	}
+
+	m_func = nullptr;
+	m_finished = true;
+
+	// the fiber function must not return
+	for (;;)
+		switchToCaller();
+}
+
+#ifdef _WIN32
+void gg::Fiber::switchToFiber()
+{
+	// only fibers can switch to other fibers
+	m_context->converted_caller = false;
+	if (IsThreadAFiber())
+	{
+		m_context->caller = GetCurrentFiber();
+	}
+	else
+	{
+		m_context->caller = ConvertThreadToFiber(nullptr);
+		m_context->converted_caller = true;
+	}
+
+	SwitchToFiber(m_context->fiber);
+
+	if (m_context->converted_caller)
+		ConvertFiberToThread();
+}
+
+void gg::Fiber::switchToCaller()
+{
+	SwitchToFiber(m_context->caller);
+}
+
+void __stdcall gg::Fiber::fiberEntry(void* fiber)
+{
+	static_cast<Fiber*>(fiber)->entry();
+}
+#else
+void gg::Fiber::switchToFiber()
+{
+	swapcontext(&m_context->caller, &m_context->fiber);
+}
+
+void gg::Fiber::switchToCaller()
+{
+	swapcontext(&m_context->fiber, &m_context->caller);
+}
+
+void gg::Fiber::fiberEntry(unsigned fiber_hi, unsigned fiber_lo)
+{
+	uintptr_t self = static_cast<uintptr_t>((static_cast<uint64_t>(fiber_hi) << 32) | fiber_lo);
+	reinterpret_cast<Fiber*>(self)->entry();
+}
+#endif
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Stackful coroutine on top of Windows fibers or POSIX ucontext. The fiber
+ * runs on the stack it was created with until it calls yield(), then the
+ * thread continues after the resume() call which switched to it.
+ *
+ * A fiber destroyed before its function returned gets resumed one last time
+ * and yield() throws FiberCancelled, so the objects on its stack are unwound.
+ */
+
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <memory>
+
+namespace gg
+{
+	class FiberCancelled
+	{
+	};
+
+	class Fiber
+	{
+	public:
+		Fiber(std::function<void()> func, size_t stack_size = 0);
+		Fiber(const Fiber&) = delete;
+		~Fiber();
+		Fiber& operator=(const Fiber&) = delete;
+
+		// runs the fiber until it yields, rethrows the exception thrown by its function
+		void resume();
+		// can only be called from the fiber itself
+		void yield();
+		bool isFinished() const;
+
+	private:
+		struct Context;
+
+		std::function<void()> m_func;
+		std::unique_ptr<Context> m_context;
+		std::exception_ptr m_error;
+		bool m_running;
+		bool m_finished;
+		bool m_cancelled;
+
+		void entry();
+		void switchToFiber();
+		void switchToCaller();
+
+#ifdef _WIN32
+		static void __stdcall fiberEntry(void* fiber);
+#else
+		static void fiberEntry(unsigned fiber_hi, unsigned fiber_lo);
+#endif
+	};
+};
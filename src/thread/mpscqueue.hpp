@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Node-based multi-producer/single-consumer queue (Dmitry Vyukov's design).
+ * Producers never wait for each other: push() is a single atomic exchange
+ * followed by linking the new node. The consumer side is not thread-safe,
+ * only the owner of the queue is allowed to call pop().
+ *
+ * pop() may report an empty queue while a producer is in the middle of
+ * push(); the element becomes visible as soon as the producer links it.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include "gg/poolallocator.hpp"
+
+namespace gg
+{
+	template<class T>
+	class MPSCQueue
+	{
+	public:
+		MPSCQueue() :
+			m_head(&m_stub),
+			m_tail(&m_stub)
+		{
+		}
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		~MPSCQueue()
+		{
+			T value;
+			while (pop(value));
+		}
+
+		void push(T value)
+		{
+			push(new Node(std::move(value)));
+		}
+
+		// the values are linked together first, so the whole batch is published at once
+		template<class Iterator>
+		void push(Iterator begin, Iterator end)
+		{
+			if (begin == end)
+				return;
+
+			Node* first = new Node(T(*begin));
+			Node* last = first;
+
+			for (++begin; begin != end; ++begin)
+			{
+				Node* node = new Node(T(*begin));
+				last->next.store(node, std::memory_order_relaxed);
+				last = node;
+			}
+
+			Node* prev = m_head.exchange(last, std::memory_order_acq_rel);
+			prev->next.store(first, std::memory_order_release);
+		}
+
+		bool pop(T& value)
+		{
+			Node* tail = m_tail;
+			Node* next = tail->next.load(std::memory_order_acquire);
+
+			// skip the stub node
+			if (tail == &m_stub)
+			{
+				if (next == nullptr)
+					return false;
+
+				m_tail = next;
+				tail = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+
+			if (next == nullptr)
+			{
+				// a producer already swapped the head but didn't link its node yet
+				if (tail != m_head.load(std::memory_order_acquire))
+					return false;
+
+				// tail is the last node, put the stub behind it so it can be unlinked
+				m_stub.next.store(nullptr, std::memory_order_relaxed);
+				push(&m_stub);
+
+				next = tail->next.load(std::memory_order_acquire);
+				if (next == nullptr)
+					return false;
+			}
+
+			m_tail = next;
+			value = std::move(tail->value);
+			delete tail;
+			return true;
+		}
+
+		bool empty() const // only reliable on the consumer side
+		{
+			return (m_tail == &m_stub && m_stub.next.load(std::memory_order_acquire) == nullptr);
+		}
+
+	private:
+		struct Node
+		{
+			Node() :
+				next(nullptr)
+			{
+			}
+
+			Node(T&& v) :
+				next(nullptr),
+				value(std::move(v))
+			{
+			}
+
+			// nodes are allocated and freed on every push and pop
+			static void* operator new(size_t)
+			{
+				return BlockPool<sizeof(Node), alignof(Node)>::allocate();
+			}
+
+			static void operator delete(void* ptr)
+			{
+				BlockPool<sizeof(Node), alignof(Node)>::deallocate(ptr);
+			}
+
+			std::atomic<Node*> next;
+			T value;
+		};
+
+		void push(Node* node)
+		{
+			Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+			prev->next.store(node, std::memory_order_release);
+		}
+
+		std::atomic<Node*> m_head; // producers
+		char m_padding[64 - sizeof(std::atomic<Node*>)]; // keep head and tail on separate cache lines
+		Node* m_tail; // consumer
+		Node m_stub;
+	};
+};
@@ -0,0 +1,349 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <sstream>
+#ifdef _WIN32
+#	include <Windows.h>
+#	include <process.h>
+#else
+#	include <cerrno>
+#	include <climits>
+#	include <sched.h>
+#	include <sys/resource.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+#include "nativethread.hpp"
+
+namespace
+{
+	struct StartResult
+	{
+		std::thread::id id;
+		bool options_applied;
+	};
+
+	struct StartParams
+	{
+		std::function<void()> func;
+		gg::ThreadOptions options;
+		std::promise<StartResult> started;
+	};
+
+	void runThread(StartParams* params_ptr)
+	{
+		std::unique_ptr<StartParams> params(params_ptr);
+		std::function<void()> func = std::move(params->func);
+
+		// options are best effort, eg. unprivileged processes can't raise the priority
+		bool options_applied = gg::NativeThread::applyOptions(params->options);
+		params->started.set_value(StartResult{ std::this_thread::get_id(), options_applied });
+		params.reset();
+
+		func();
+	}
+
+#ifdef _WIN32
+	unsigned __stdcall threadEntry(void* params)
+	{
+		runThread(static_cast<StartParams*>(params));
+		return 0;
+	}
+
+	int getWindowsPriority(int nice)
+	{
+		if (nice <= -15) return THREAD_PRIORITY_HIGHEST;
+		if (nice < 0) return THREAD_PRIORITY_ABOVE_NORMAL;
+		if (nice == 0) return THREAD_PRIORITY_NORMAL;
+		if (nice < 15) return THREAD_PRIORITY_BELOW_NORMAL;
+		return THREAD_PRIORITY_LOWEST;
+	}
+#else
+	void* threadEntry(void* params)
+	{
+		runThread(static_cast<StartParams*>(params));
+		return nullptr;
+	}
+
+	// parses the cpulist format of sysfs (eg. "0-3,8-11")
+	bool getNumaNodeCores(int node, cpu_set_t& cores)
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!std::getline(file, list))
+			return false;
+
+		CPU_ZERO(&cores);
+
+		std::istringstream ss(list);
+		std::string range;
+		while (std::getline(ss, range, ','))
+		{
+			if (range.empty())
+				continue;
+
+			size_t dash = range.find('-');
+			unsigned first = std::stoul(range.substr(0, dash));
+			unsigned last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+
+			for (unsigned core = first; core <= last && core < CPU_SETSIZE; ++core)
+				CPU_SET(core, &cores);
+		}
+
+		return (CPU_COUNT(&cores) > 0);
+	}
+#endif
+};
+
+
+gg::NativeThread::NativeThread() :
+	m_handle(),
+	m_joinable(false),
+	m_options_applied(true)
+{
+}
+
+gg::NativeThread::~NativeThread()
+{
+	if (!m_joinable)
+		return;
+
+#ifdef _WIN32
+	CloseHandle(m_handle);
+#else
+	pthread_detach(m_handle);
+#endif
+}
+
+bool gg::NativeThread::start(std::function<void()> func, const ThreadOptions& options)
+{
+	if (m_joinable)
+		return false;
+
+	StartParams* params = new StartParams{ std::move(func), options, {} };
+	std::future<StartResult> started = params->started.get_future();
+
+#ifdef _WIN32
+	m_handle = reinterpret_cast<void*>(_beginthreadex(
+		nullptr, static_cast<unsigned>(options.stack_size), &threadEntry, params, 0, nullptr));
+
+	if (m_handle == nullptr)
+	{
+		delete params;
+		return false;
+	}
+#else
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+
+	if (options.stack_size)
+		pthread_attr_setstacksize(&attr, std::max<size_t>(options.stack_size, PTHREAD_STACK_MIN));
+
+	int result = pthread_create(&m_handle, &attr, &threadEntry, params);
+	pthread_attr_destroy(&attr);
+
+	if (result != 0)
+	{
+		delete params;
+		return false;
+	}
+#endif
+
+	StartResult start_result = started.get();
+	m_joinable = true;
+	m_id = start_result.id;
+	m_options_applied = start_result.options_applied;
+	return true;
+}
+
+bool gg::NativeThread::joinable() const
+{
+	return m_joinable;
+}
+
+void gg::NativeThread::join()
+{
+	if (!m_joinable)
+		return;
+
+#ifdef _WIN32
+	WaitForSingleObject(m_handle, INFINITE);
+	CloseHandle(m_handle);
+#else
+	pthread_join(m_handle, nullptr);
+#endif
+
+	m_joinable = false;
+	m_id = std::thread::id();
+}
+
+std::thread::id gg::NativeThread::getID() const
+{
+	return m_id;
+}
+
+bool gg::NativeThread::areOptionsApplied() const
+{
+	return m_options_applied;
+}
+
+bool gg::NativeThread::applyOptions(const ThreadOptions& options)
+{
+	bool success = true;
+
+#ifdef _WIN32
+	if (options.numa_node >= 0)
+	{
+		GROUP_AFFINITY affinity = {};
+		if (GetNumaNodeProcessorMaskEx(static_cast<USHORT>(options.numa_node), &affinity))
+		{
+			// cores are numbered within the processor group of the node
+			if (!options.cores.empty())
+			{
+				KAFFINITY mask = 0;
+				for (unsigned core : options.cores)
+				{
+					if (core < sizeof(KAFFINITY) * 8)
+						mask |= (KAFFINITY)1 << core;
+				}
+				affinity.Mask &= mask;
+			}
+
+			success &= (affinity.Mask != 0 && SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr));
+		}
+		else
+		{
+			success = false;
+		}
+	}
+	else if (!options.cores.empty())
+	{
+		DWORD_PTR mask = 0;
+		for (unsigned core : options.cores)
+		{
+			if (core < sizeof(DWORD_PTR) * 8)
+				mask |= (DWORD_PTR)1 << core;
+		}
+
+		success &= (mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0);
+	}
+
+	if (options.priority != 0)
+		success &= (SetThreadPriority(GetCurrentThread(), getWindowsPriority(options.priority)) != 0);
+#else
+	if (options.numa_node >= 0 || !options.cores.empty())
+	{
+		cpu_set_t cores;
+		CPU_ZERO(&cores);
+
+		if (!options.cores.empty())
+		{
+			for (unsigned core : options.cores)
+			{
+				if (core < CPU_SETSIZE)
+					CPU_SET(core, &cores);
+			}
+		}
+
+		if (options.numa_node >= 0)
+		{
+			// memory is allocated on the node of the first touch, so keeping the
+			// thread on the node keeps its allocations local as well
+			cpu_set_t node_cores;
+			if (getNumaNodeCores(options.numa_node, node_cores))
+			{
+				if (options.cores.empty())
+					cores = node_cores;
+				else
+					CPU_AND(&cores, &cores, &node_cores);
+			}
+			else
+			{
+				success = false;
+			}
+		}
+
+		success &= (CPU_COUNT(&cores) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0);
+	}
+
+	// the nice value is per thread on Linux
+	if (options.priority != 0)
+		success &= (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), options.priority) == 0);
+#endif
+
+	return success;
+}
+
+
+gg::ScopedThreadOptions::ScopedThreadOptions(const ThreadOptions& options) :
+	m_applied(true),
+	m_affinity_saved(false),
+	m_priority_saved(false),
+	m_priority(0)
+{
+	// only what the options change is restored
+#ifdef _WIN32
+	if (options.numa_node >= 0 || !options.cores.empty())
+	{
+		GROUP_AFFINITY affinity = {};
+		m_affinity_saved = (GetThreadGroupAffinity(GetCurrentThread(), &affinity) != 0);
+		m_affinity_mask = affinity.Mask;
+		m_affinity_group = affinity.Group;
+	}
+
+	if (options.priority != 0)
+	{
+		m_priority = GetThreadPriority(GetCurrentThread());
+		m_priority_saved = (m_priority != THREAD_PRIORITY_ERROR_RETURN);
+	}
+#else
+	if (options.numa_node >= 0 || !options.cores.empty())
+		m_affinity_saved = (pthread_getaffinity_np(pthread_self(), sizeof(m_affinity), &m_affinity) == 0);
+
+	if (options.priority != 0)
+	{
+		// -1 is a valid nice value, only errno tells an error
+		errno = 0;
+		m_priority = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+		m_priority_saved = (errno == 0);
+	}
+#endif
+
+	m_applied = NativeThread::applyOptions(options);
+}
+
+gg::ScopedThreadOptions::~ScopedThreadOptions()
+{
+#ifdef _WIN32
+	if (m_affinity_saved)
+	{
+		GROUP_AFFINITY affinity = {};
+		affinity.Mask = static_cast<KAFFINITY>(m_affinity_mask);
+		affinity.Group = m_affinity_group;
+		SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+	}
+
+	if (m_priority_saved)
+		SetThreadPriority(GetCurrentThread(), m_priority);
+#else
+	if (m_affinity_saved)
+		pthread_setaffinity_np(pthread_self(), sizeof(m_affinity), &m_affinity);
+
+	if (m_priority_saved)
+		setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), m_priority);
+#endif
+}
+
+bool gg::ScopedThreadOptions::isApplied() const
+{
+	return m_applied;
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Thin wrapper around the platform thread API. Unlike std::thread it can
+ * start threads with a custom stack size and pin them to cores, NUMA nodes
+ * or run them with a different priority (see gg::ThreadOptions).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <thread>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "gg/thread.hpp"
+
+namespace gg
+{
+	class NativeThread
+	{
+	public:
+		NativeThread();
+		NativeThread(const NativeThread&) = delete;
+		~NativeThread();
+		NativeThread& operator=(const NativeThread&) = delete;
+
+		// returns once the new thread applied the options and is about to run 'func'
+		bool start(std::function<void()> func, const ThreadOptions&);
+		bool joinable() const;
+		void join();
+		std::thread::id getID() const;
+		bool areOptionsApplied() const; // result of applyOptions() in the last started thread
+
+		// applies affinity and priority to the calling thread, returns false if any of them failed
+		static bool applyOptions(const ThreadOptions&);
+
+	private:
+#ifdef _WIN32
+		void* m_handle;
+#else
+		pthread_t m_handle;
+#endif
+		bool m_joinable;
+		bool m_options_applied;
+		std::thread::id m_id;
+	};
+
+	// applies the options to the calling thread and restores its previous affinity and
+	// priority when destroyed (unprivileged processes might not be allowed to raise it back)
+	class ScopedThreadOptions
+	{
+	public:
+		ScopedThreadOptions(const ThreadOptions&);
+		ScopedThreadOptions(const ScopedThreadOptions&) = delete;
+		~ScopedThreadOptions();
+		ScopedThreadOptions& operator=(const ScopedThreadOptions&) = delete;
+		bool isApplied() const;
+
+	private:
+		bool m_applied;
+		bool m_affinity_saved;
+		bool m_priority_saved;
+		int m_priority;
+#ifdef _WIN32
+		uint64_t m_affinity_mask;
+		uint16_t m_affinity_group;
+#else
+		cpu_set_t m_affinity;
+#endif
+	};
+};
@@ -6,215 +6,1100 @@
  * All rights reserved.
  */
 
+#include <algorithm>
+#include <iterator>
+#include <typeinfo>
+#include "eventrecorder.hpp"
 #include "thread_impl.hpp"
 
+static gg::EventTypeRegistry& getEventTypeRegistry()
+{
+	// never destroyed, event definitions might unregister during static destruction
+	static gg::EventTypeRegistry* event_types = new gg::EventTypeRegistry();
+	return *event_types;
+}
+
+gg::IEventTypeRegistry& gg::getEventTypes()
+{
+	return getEventTypeRegistry();
+}
+
 static gg::ThreadManager s_thread;
 gg::IThreadManager& gg::threadmgr = s_thread;
 
+static uint64_t getElapsedUs(std::chrono::steady_clock::time_point since)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+static void storeMax(std::atomic<uint64_t>& max, uint64_t value)
+{
+	// there is only one writer
+	if (value > max.load(std::memory_order_relaxed))
+		max.store(value, std::memory_order_relaxed);
+}
+
+
+gg::SubscriptionIndex::SubscriptionIndex() :
+	m_subscription_count(0)
+{
+}
+
+gg::SubscriptionIndex::~SubscriptionIndex()
+{
+}
+
+void gg::SubscriptionIndex::add(IEvent::Type type, TaskData* task)
+{
+	add(m_subscribers[task->getState()], type, task);
+}
+
+void gg::SubscriptionIndex::remove(IEvent::Type type, TaskData* task)
+{
+	auto it = m_subscribers.find(task->getState());
+	if (it != m_subscribers.end())
+		remove(it->second, type, task);
+}
+
+void gg::SubscriptionIndex::move(const std::vector<IEvent::Type>& types, TaskData* task, IThread::State old_state, IThread::State new_state)
+{
+	if (types.empty())
+		return;
+
+	Subscribers& old_subscribers = m_subscribers[old_state];
+	Subscribers& new_subscribers = m_subscribers[new_state];
+
+	for (IEvent::Type type : types)
+	{
+		remove(old_subscribers, type, task);
+		add(new_subscribers, type, task);
+	}
+}
+
+void gg::SubscriptionIndex::dispatch(const std::vector<EventPtr>& events, IThread::State state)
+{
+	if (m_subscription_count == 0)
+		return;
+
+	// tasks in other states would drop the events anyway
+	auto it = m_subscribers.find(state);
+	if (it == m_subscribers.end())
+		return;
+
+	Subscribers& subscribers = it->second;
+	const EventTypeRegistry& event_types = getEventTypeRegistry();
+
+	for (auto& event : events)
+	{
+		// unregistered types have an invalid ID, which is out of range
+		auto id = event_types.findID(event->getType());
+		if (id >= subscribers.size())
+			continue;
+
+		for (TaskData* task : subscribers[id])
+			task->pushEvent(event);
+	}
+}
+
+void gg::SubscriptionIndex::add(Subscribers& subscribers, IEvent::Type type, TaskData* task)
+{
+	auto id = getEventTypeRegistry().getOrAddID(type);
+	if (id >= subscribers.size())
+		subscribers.resize(id + 1);
+
+	subscribers[id].push_back(task);
+	++m_subscription_count;
+}
+
+void gg::SubscriptionIndex::remove(Subscribers& subscribers, IEvent::Type type, TaskData* task)
+{
+	auto id = getEventTypeRegistry().findID(type);
+	if (id >= subscribers.size())
+		return;
+
+	auto& tasks = subscribers[id];
+	auto it = std::remove(tasks.begin(), tasks.end(), task);
+	m_subscription_count -= std::distance(it, tasks.end());
+	tasks.erase(it, tasks.end());
+}
+
+gg::MailboxIndex::MailboxIndex()
+{
+}
+
+gg::MailboxIndex::~MailboxIndex()
+{
+}
+
+void gg::MailboxIndex::add(IEvent::Type type, TaskMailbox* mailbox)
+{
+	auto id = getEventTypeRegistry().getOrAddID(type);
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (id >= m_mailboxes.size())
+		m_mailboxes.resize(id + 1);
+
+	m_mailboxes[id].push_back(mailbox);
+}
+
+void gg::MailboxIndex::remove(IEvent::Type type, TaskMailbox* mailbox)
+{
+	auto id = getEventTypeRegistry().findID(type);
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (id >= m_mailboxes.size())
+		return;
+
+	auto& mailboxes = m_mailboxes[id];
+	mailboxes.erase(std::remove(mailboxes.begin(), mailboxes.end(), mailbox), mailboxes.end());
+}
+
+void gg::MailboxIndex::dispatch(const EventPtr* events, size_t count, std::vector<IThread*>& owners)
+{
+	const EventTypeRegistry& event_types = getEventTypeRegistry();
+
+	// mailboxes unregister in close() under this lock, so none of them can go away meanwhile
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!events[i])
+			continue;
+
+		// unregistered types have an invalid ID, which is out of range
+		auto id = event_types.findID(events[i]->getType());
+		if (id >= m_mailboxes.size())
+			continue;
+
+		for (TaskMailbox* mailbox : m_mailboxes[id])
+		{
+			if (!mailbox->push(events[i]))
+				continue;
+
+			// pending tasks have no owner yet, they take their events when adopted
+			IThread* owner = mailbox->getOwner();
+			if (owner && std::find(owners.begin(), owners.end(), owner) == owners.end())
+				owners.push_back(owner);
+		}
+	}
+}
+
+
+gg::TaskMailbox::TaskMailbox(MailboxIndexPtr index) :
+	m_index(std::move(index)),
+	m_owner(nullptr),
+	m_closed(false)
+{
+}
+
+gg::TaskMailbox::~TaskMailbox()
+{
+	close();
+}
+
+// subscriptions change only on the thread of the task, so they need no lock
+
+void gg::TaskMailbox::subscribe(IEvent::Type type)
+{
+	if (m_closed)
+		return;
+
+	for (IEvent::Type subscription : m_subscriptions)
+	{
+		if (type == subscription)
+			return;
+	}
+
+	m_subscriptions.push_back(type);
+	m_index->add(type, this);
+}
+
+void gg::TaskMailbox::unsubscribe(IEvent::Type type)
+{
+	for (auto it = m_subscriptions.begin(), end = m_subscriptions.end(); it != end; ++it)
+	{
+		if (*it == type)
+		{
+			m_subscriptions.erase(it);
+			m_index->remove(type, this);
+			return;
+		}
+	}
+}
+
+bool gg::TaskMailbox::push(const EventPtr& event)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (m_closed)
+		return false;
+
+	m_events.push_back(event);
+	return true;
+}
+
+void gg::TaskMailbox::takeEvents(std::vector<EventPtr>& events)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	events.swap(m_events);
+}
+
+void gg::TaskMailbox::close()
+{
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+		m_closed = true;
+		m_events.clear();
+	}
+
+	for (IEvent::Type subscription : m_subscriptions)
+		m_index->remove(subscription, this);
+
+	m_subscriptions.clear();
+}
+
+void gg::TaskMailbox::setOwner(IThread* thread)
+{
+	m_owner = thread;
+}
+
+gg::IThread* gg::TaskMailbox::getOwner() const
+{
+	return m_owner;
+}
+
+
+gg::TaskCounters::TaskCounters(ITask::ID task_id, std::string name) :
+	m_task_id(task_id),
+	m_name(std::move(name)),
+	m_update_count(0),
+	m_update_time_us(0),
+	m_max_update_time_us(0),
+	m_event_count(0),
+	m_event_time_us(0),
+	m_max_event_time_us(0),
+	m_error_count(0)
+{
+}
+
+void gg::TaskCounters::addUpdate(uint64_t time_us)
+{
+	m_update_count.fetch_add(1, std::memory_order_relaxed);
+	m_update_time_us.fetch_add(time_us, std::memory_order_relaxed);
+	storeMax(m_max_update_time_us, time_us);
+}
+
+void gg::TaskCounters::addEvent(uint64_t time_us)
+{
+	m_event_count.fetch_add(1, std::memory_order_relaxed);
+	m_event_time_us.fetch_add(time_us, std::memory_order_relaxed);
+	storeMax(m_max_event_time_us, time_us);
+}
+
+void gg::TaskCounters::addError()
+{
+	m_error_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+gg::TaskMetrics gg::TaskCounters::getMetrics() const
+{
+	TaskMetrics metrics;
+	metrics.task_id = m_task_id;
+	metrics.name = m_name;
+	metrics.update_count = m_update_count.load(std::memory_order_relaxed);
+	metrics.update_time_us = m_update_time_us.load(std::memory_order_relaxed);
+	metrics.max_update_time_us = m_max_update_time_us.load(std::memory_order_relaxed);
+	metrics.event_count = m_event_count.load(std::memory_order_relaxed);
+	metrics.event_time_us = m_event_time_us.load(std::memory_order_relaxed);
+	metrics.max_event_time_us = m_max_event_time_us.load(std::memory_order_relaxed);
+	metrics.error_count = m_error_count.load(std::memory_order_relaxed);
+	return metrics;
+}
+
+
+gg::TaskCountersList::TaskCountersList() :
+	m_prune_size(16)
+{
+}
+
+gg::TaskCountersList::~TaskCountersList()
+{
+}
+
+void gg::TaskCountersList::add(TaskCountersPtr counters)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	// drop finished tasks once in a while, the list is not necessarily queried
+	if (m_counters.size() >= m_prune_size)
+	{
+		m_counters.erase(std::remove_if(m_counters.begin(), m_counters.end(),
+			[](const std::weak_ptr<TaskCounters>& c) { return c.expired(); }), m_counters.end());
+
+		m_prune_size = std::max<size_t>(16, m_counters.size() * 2);
+	}
+
+	m_counters.push_back(counters);
+}
+
+std::vector<gg::TaskMetrics> gg::TaskCountersList::getMetrics() const
+{
+	std::vector<TaskMetrics> metrics;
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	for (auto& c : m_counters)
+	{
+		auto counters = c.lock();
+		if (counters)
+			metrics.push_back(counters->getMetrics());
+	}
+
+	return metrics;
+}
+
+
+gg::TaskData::TaskData(gg::IThread* thread, TaskPtr task, ITask::ID task_id, IThread::State state, SubscriptionIndex* index, TaskCountersList& counters) :
+	m_thread(thread),
+	m_task(std::move(task)),
+	m_task_id(task_id),
+	m_task_state(state),
+	m_update_interval(0),
+	m_event_driven(false),
+	m_finished(false),
+	m_index(index)
+{
+	start(counters);
+}
+
+gg::TaskData::TaskData(gg::IThread* thread, TaskPtr task, ITask::ID task_id, IThread::State state, TaskMailboxPtr mailbox, TaskCountersList& counters) :
+	m_thread(thread),
+	m_task(std::move(task)),
+	m_task_id(task_id),
+	m_task_state(state),
+	m_update_interval(0),
+	m_event_driven(false),
+	m_finished(false),
+	m_index(nullptr),
+	m_mailbox(std::move(mailbox))
+{
+	if (m_mailbox)
+		m_mailbox->setOwner(thread);
+
+	start(counters);
+}
+
+gg::TaskData::~TaskData()
+{
+	if (m_index)
+	{
+		for (IEvent::Type subscription : m_subscriptions)
+			m_index->remove(subscription, this);
+	}
+
+	if (m_mailbox)
+		m_mailbox->close();
+}
+
+void gg::TaskData::start(TaskCountersList& counters)
+{
+	m_counters = std::make_shared<TaskCounters>(m_task_id, typeid(*m_task).name());
+	counters.add(m_counters);
+
+	try
+	{
+		m_task->onStart(*this);
+	}
+	catch (...)
+	{
+		finish();
+	}
+}
+
+gg::IThread& gg::TaskData::getThread()
+{
+	return *m_thread;
+}
+
+gg::ITask::ID gg::TaskData::getTaskID() const
+{
+	return m_task_id;
+}
+
+gg::IThread::State gg::TaskData::getState() const
+{
+	return m_task_state;
+}
+
+void gg::TaskData::setState(IThread::State state)
+{
+	if (state == m_task_state)
+		return;
+
+	// the index keeps the subscriptions by state
+	if (m_index)
+		m_index->move(m_subscriptions, this, m_task_state, state);
+
+	m_task_state = state;
+}
+
+void gg::TaskData::subscribe(IEvent::Type type)
+{
+	for (IEvent::Type subscription : m_subscriptions)
+	{
+		if (type == subscription)
+			return;
+	}
+
+	m_subscriptions.push_back(type);
+
+	if (m_index)
+		m_index->add(type, this);
+
+	if (m_mailbox)
+		m_mailbox->subscribe(type);
+}
+
+void gg::TaskData::subscribe(IEventDefinitionBase& def)
+{
+	subscribe(def.getType());
+}
+
+void gg::TaskData::unsubscribe(IEvent::Type type)
+{
+	if (m_mailbox)
+		m_mailbox->unsubscribe(type);
+
+	for (auto it = m_subscriptions.begin(), end = m_subscriptions.end(); it != end; ++it)
+	{
+		if (*it == type)
+		{
+			m_subscriptions.erase(it);
+
+			if (m_index)
+				m_index->remove(type, this);
+
+			return;
+		}
+	}
+}
+
+void gg::TaskData::unsubscribe(IEventDefinitionBase& def)
+{
+	unsubscribe(def.getType());
+}
+
+uint32_t gg::TaskData::getElapsedMs() const
+{
+	return static_cast<uint32_t>(m_timer.peekElapsed());
+}
+
+void gg::TaskData::finish()
+{
+	m_finished = true;
+
+	if (m_mailbox)
+		m_mailbox->close();
+
+	try
+	{
+		m_task->onFinish(*this);
+	}
+	catch (...)
+	{
+	}
+}
+
+void gg::TaskData::setUpdateInterval(uint32_t ms)
+{
+	m_update_interval = ms;
+}
+
+void gg::TaskData::setEventDriven(bool event_driven)
+{
+	m_event_driven = event_driven;
+}
+
+bool gg::TaskData::isFinished() const
+{
+	return m_finished;
+}
+
+bool gg::TaskData::isSubscribed(IEvent::Type event_type) const
+{
+	for (IEvent::Type subscription : m_subscriptions)
+	{
+		if (event_type == subscription)
+			return true;
+	}
+
+	return false;
+}
+
+uint32_t gg::TaskData::getTimeToUpdate() const
+{
+	if (m_update_interval == 0)
+		return (m_event_driven ? UINT32_MAX : 0);
+
+	uint32_t elapsed = getElapsedMs();
+	return (elapsed < m_update_interval) ? (m_update_interval - elapsed) : 0;
+}
+
+bool gg::TaskData::isUpdateDue(bool got_events) const
+{
+	if (m_update_interval == 0 && !m_event_driven)
+		return true;
+
+	if (m_event_driven && got_events)
+		return true;
+
+	return (m_update_interval > 0 && getElapsedMs() >= m_update_interval);
+}
+
+void gg::TaskData::setThread(IThread* thread)
+{
+	m_thread = thread;
+
+	if (m_mailbox)
+		m_mailbox->setOwner(thread);
+}
+
+void gg::TaskData::pushEvent(const EventPtr& event)
+{
+	m_events.push_back(event);
+}
+
+void gg::TaskData::clearEvents()
+{
+	m_events.clear();
+}
+
+void gg::TaskData::update()
+{
+	bool got_events = false;
+
+	if (m_mailbox)
+		m_mailbox->takeEvents(m_events);
+
+	for (auto& event : m_events)
+	{
+		// the task might have unsubscribed while processing a previous event
+		if (isSubscribed(event->getType()))
+		{
+			got_events = true;
+
+			auto start_time = std::chrono::steady_clock::now();
+
+			try
+			{
+				m_task->onEvent(*this, std::move(event));
+			}
+			catch (std::exception& e)
+			{
+				error(e);
+			}
+			catch (...)
+			{
+				error(std::runtime_error("unknown"));
+			}
+
+			m_counters->addEvent(getElapsedUs(start_time));
+		}
+	}
+	m_events.clear();
+
+	// periodic and event-driven tasks only get updated when due
+	if (!isUpdateDue(got_events))
+		return;
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	try
+	{
+		m_task->onUpdate(*this);
+	}
+	catch (std::exception& e)
+	{
+		error(e);
+	}
+	catch (...)
+	{
+		error(std::runtime_error("unknown"));
+	}
+
+	m_counters->addUpdate(getElapsedUs(start_time));
+	m_timer.reset();
+}
+
+void gg::TaskData::stateChange(IThread::State old_state, IThread::State new_state)
+{
+	m_task->onStateChange(*this, old_state, new_state);
+}
+
+void gg::TaskData::error(std::exception& e)
+{
+	m_counters->addError();
+
+	try
+	{
+		m_task->onError(*this, e);
+	}
+	catch (...)
+	{
+		finish();
+	}
+}
+
+
+gg::CoroutineTask::CoroutineTask(CoroutineFunc func, size_t stack_size) :
+	m_options(nullptr),
+	m_wait(Wait::NONE),
+	m_event_type(0),
+	m_poll_ms(0),
+	m_max_poll_ms(0),
+	m_fiber([this, func] { func(*this); }, stack_size)
+{
+}
+
+gg::CoroutineTask::~CoroutineTask()
+{
+}
+
+void gg::CoroutineTask::onStart(ITaskOptions& options)
+{
+	// the coroutine starts in the first update as onStart might run on another thread
+	m_options = &options;
+}
+
+void gg::CoroutineTask::onEvent(ITaskOptions&, EventPtr event)
+{
+	m_events.push_back(std::move(event));
+}
+
+void gg::CoroutineTask::onUpdate(ITaskOptions& options)
+{
+	m_options = &options;
+
+	if (!isReady())
+		return;
+
+	m_wait = Wait::NONE;
+
+	try
+	{
+		m_fiber.resume();
+	}
+	catch (...)
+	{
+		options.finish();
+		throw;
+	}
+
+	if (m_fiber.isFinished())
+		options.finish();
+}
+
+gg::ITaskOptions& gg::CoroutineTask::getOptions()
+{
+	return *m_options;
+}
+
+gg::EventPtr gg::CoroutineTask::waitEvent(IEvent::Type type)
+{
+	EventPtr event = takeEvent(type);
+	if (event)
+		return event;
+
+	// the subscription is kept, so events arriving later are queued
+	m_options->subscribe(type);
+	m_event_type = type;
+	suspend(Wait::EVENT, 0);
+
+	return takeEvent(type);
+}
+
+gg::EventPtr gg::CoroutineTask::waitEvent(IEventDefinitionBase& def)
+{
+	return waitEvent(def.getType());
+}
+
+void gg::CoroutineTask::sleep(uint32_t ms)
+{
+	m_wake_time = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+	suspend(Wait::SLEEP, std::max(ms, 1u));
+}
+
+void gg::CoroutineTask::waitUntil(std::function<bool()> condition, uint32_t poll_ms, uint32_t max_poll_ms)
+{
+	if (condition())
+		return;
+
+	m_condition = std::move(condition);
+	m_poll_ms = std::max(poll_ms, 1u);
+	m_max_poll_ms = max_poll_ms;
+	suspend(Wait::CONDITION, m_poll_ms);
+	m_condition = nullptr;
+}
+
+bool gg::CoroutineTask::isReady()
+{
+	switch (m_wait)
+	{
+	case Wait::EVENT:
+		for (auto& event : m_events)
+		{
+			if (event->getType() == m_event_type)
+				return true;
+		}
+		return false;
+
+	case Wait::SLEEP:
+		return (std::chrono::steady_clock::now() >= m_wake_time);
+
+	case Wait::CONDITION:
+		if (m_condition())
+			return true;
+
+		// backs off while the condition stays false
+		if (m_poll_ms < m_max_poll_ms)
+		{
+			m_poll_ms = std::min(m_poll_ms * 2, m_max_poll_ms);
+			m_options->setUpdateInterval(m_poll_ms);
+		}
+		return false;
+
+	default:
+		return true;
+	}
+}
 
-gg::TaskData::TaskData(gg::IThread* thread, TaskPtr task, ITask::ID task_id, IThread::State state) :
-	m_thread(thread),
-	m_task(std::move(task)),
-	m_task_id(task_id),
-	m_task_state(state),
-	m_finished(false)
+gg::EventPtr gg::CoroutineTask::takeEvent(IEvent::Type type)
 {
-	try
-	{
-		m_task->onStart(*this);
-	}
-	catch (...)
+	for (auto it = m_events.begin(); it != m_events.end(); ++it)
 	{
-		finish();
+		if ((*it)->getType() == type)
+		{
+			EventPtr event = std::move(*it);
+			m_events.erase(it);
+			return event;
+		}
 	}
-}
 
-gg::TaskData::TaskData(gg::TaskData&& taskdata) :
-	m_thread(taskdata.m_thread),
-	m_task(std::move(taskdata.m_task)),
-	m_task_id(taskdata.m_task_id),
-	m_task_state(taskdata.m_task_state),
-	m_subscriptions(std::move(taskdata.m_subscriptions)),
-	m_finished(false)
-{
+	return {};
 }
 
-gg::TaskData::~TaskData()
+void gg::CoroutineTask::suspend(Wait wait, uint32_t update_interval)
 {
+	// the task is only updated when an event arrives or the interval elapses
+	m_wait = wait;
+	m_options->setEventDriven(true);
+	m_options->setUpdateInterval(update_interval);
+
+	m_fiber.yield();
+
+	m_options->setEventDriven(false);
+	m_options->setUpdateInterval(0);
 }
 
-gg::TaskData& gg::TaskData::operator=(TaskData&& taskdata)
+
+gg::TaskQueue::TaskQueue()
 {
-	m_thread = taskdata.m_thread;
-	m_task = std::move(taskdata.m_task);
-	m_task_id = taskdata.m_task_id;
-	m_task_state = taskdata.m_task_state;
-	m_subscriptions = std::move(taskdata.m_subscriptions);
-	m_finished = false;
-	return *this;
 }
 
-gg::IThread& gg::TaskData::getThread()
+gg::TaskQueue::~TaskQueue()
 {
-	return *m_thread;
 }
 
-gg::ITask::ID gg::TaskData::getTaskID() const
+size_t gg::TaskQueue::size() const
 {
-	return m_task_id;
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	return m_tasks.size();
 }
 
-gg::IThread::State gg::TaskData::getState() const
+void gg::TaskQueue::push(TaskDataPtr task)
 {
-	return m_task_state;
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_tasks.push_back(std::move(task));
 }
 
-void gg::TaskData::setState(IThread::State state)
+gg::TaskDataPtr gg::TaskQueue::pop()
 {
-	m_task_state = state;
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (m_tasks.empty())
+		return {};
+
+	TaskDataPtr task = std::move(m_tasks.front());
+	m_tasks.pop_front();
+	return task;
 }
 
-void gg::TaskData::subscribe(IEvent::Type type)
+size_t gg::TaskQueue::steal(TaskQueue& victim)
 {
-	for (IEvent::Type subscription : m_subscriptions)
+	if (&victim == this)
+		return 0;
+
+	std::unique_lock<decltype(m_mutex)> l1(m_mutex, std::defer_lock);
+	std::unique_lock<decltype(m_mutex)> l2(victim.m_mutex, std::defer_lock);
+	std::lock(l1, l2);
+
+	// take the half from the back, the owner keeps working on the front
+	size_t count = (victim.m_tasks.size() + 1) / 2;
+	for (size_t i = 0; i < count; ++i)
 	{
-		if (type == subscription)
-			return;
+		m_tasks.push_back(std::move(victim.m_tasks.back()));
+		victim.m_tasks.pop_back();
 	}
 
-	m_subscriptions.push_back(type);
+	return count;
 }
 
-void gg::TaskData::subscribe(IEventDefinitionBase& def)
+void gg::TaskQueue::clear()
 {
-	subscribe(def.getType());
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	m_tasks.clear();
 }
 
-void gg::TaskData::unsubscribe(IEvent::Type type)
+
+gg::TaskScheduler::TaskScheduler() :
+	m_pending_count(0),
+	m_idle_count(0),
+	m_mailboxes(std::make_shared<MailboxIndex>())
 {
-	for (auto it = m_subscriptions.begin(), end = m_subscriptions.end(); it != end; ++it)
-	{
-		if (*it == type)
-		{
-			m_subscriptions.erase(it);
-			return;
-		}
-	}
 }
 
-void gg::TaskData::unsubscribe(IEventDefinitionBase& def)
+gg::TaskScheduler::~TaskScheduler()
 {
-	unsubscribe(def.getType());
 }
 
-uint32_t gg::TaskData::getElapsedMs() const
+void gg::TaskScheduler::addWorker(Thread* thread)
 {
-	return static_cast<uint32_t>(m_timer.peekElapsed());
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	for (Thread* worker : m_workers)
+	{
+		if (worker == thread)
+			return;
+	}
+
+	{
+		std::lock_guard<decltype(m_wake_mutex)> wake_guard(m_wake_mutex);
+		m_workers.push_back(thread);
+	}
+
+	if (m_pending_count > 0)
+		thread->wake();
 }
 
-void gg::TaskData::finish()
+void gg::TaskScheduler::removeWorker(Thread* thread)
 {
-	m_finished = true;
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
 
-	try
+	for (auto it = m_workers.begin(), end = m_workers.end(); it != end; ++it)
 	{
-		m_task->onFinish(*this);
+		if (*it == thread)
+		{
+			std::lock_guard<decltype(m_wake_mutex)> wake_guard(m_wake_mutex);
+			m_workers.erase(it);
+			break;
+		}
 	}
-	catch (...)
+
+	// the removed thread keeps its tasks if there is nobody to take them over
+	Thread* sibling = getLeastBusyWorker();
+	if (sibling)
 	{
+		while (sibling->getTaskQueue().steal(thread->getTaskQueue()) > 0);
+		sibling->wake();
 	}
 }
 
-bool gg::TaskData::isFinished() const
+void gg::TaskScheduler::addTask(TaskPtr&& task)
 {
-	return m_finished;
+	TaskMailboxPtr mailbox(new TaskMailbox(m_mailboxes));
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	m_pending_tasks.push_back(PendingTask{ std::move(task), m_task_id_generator.next(), std::move(mailbox) });
+	++m_pending_count;
+
+	Thread* worker = getLeastBusyWorker();
+	if (worker)
+		worker->wake();
 }
 
-bool gg::TaskData::isSubscribed(IEvent::Type event_type) const
+std::vector<gg::TaskMetrics> gg::TaskScheduler::getTaskMetrics() const
 {
-	for (IEvent::Type subscription : m_subscriptions)
+	return m_task_counters.getMetrics();
+}
+
+void gg::TaskScheduler::sendEvent(EventPtr event)
+{
+	if (!event)
+		return;
+
+	sendEvents(&event, 1);
+}
+
+void gg::TaskScheduler::sendEvents(const EventPtr* events, size_t count)
+{
+	if (count == 0)
+		return;
+
+	std::vector<IThread*> owners;
+	m_mailboxes->dispatch(events, count, owners);
+
+	if (owners.empty())
+		return;
+
+	// an owner might have left the pool since it last ran the task, then
+	// its tasks were handed over to a sibling which is awake already
+	std::lock_guard<decltype(m_wake_mutex)> guard(m_wake_mutex);
+
+	for (Thread* worker : m_workers)
 	{
-		if (event_type == subscription)
-			return true;
+		if (std::find(owners.begin(), owners.end(), worker) != owners.end())
+			worker->wake();
 	}
-
-	return false;
 }
 
-void gg::TaskData::update(const std::vector<EventPtr>& events)
+bool gg::TaskScheduler::fetchTasks(Thread& thread)
 {
-	if (!events.empty() && !m_subscriptions.empty())
+	TaskQueue& queue = thread.getTaskQueue();
+
+	if (m_pending_count == 0 && queue.size() > 0)
+		return false;
+
+	std::vector<PendingTask> tasks;
+
 	{
-		for (auto& event : events)
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+		if (!m_pending_tasks.empty())
 		{
-			if (isSubscribed(event->getType()))
+			// take a fair share of new tasks, the rest is left for siblings
+			size_t workers = (m_workers.empty() ? 1 : m_workers.size());
+			size_t count = (m_pending_tasks.size() + workers - 1) / workers;
+
+			tasks.insert(tasks.end(),
+				std::make_move_iterator(m_pending_tasks.end() - count),
+				std::make_move_iterator(m_pending_tasks.end()));
+			m_pending_tasks.resize(m_pending_tasks.size() - count);
+			m_pending_count -= count;
+		}
+		else if (queue.size() == 0)
+		{
+			// nothing new to do, steal from the busiest sibling
+			Thread* victim = nullptr;
+			size_t victim_tasks = 1;
+
+			for (Thread* worker : m_workers)
 			{
-				try
+				size_t worker_tasks = worker->getTaskQueue().size();
+				if (worker != &thread && worker_tasks > victim_tasks)
 				{
-					m_task->onEvent(*this, std::move(event));
-				}
-				catch (std::exception& e)
-				{
-					error(e);
-				}
-				catch (...)
-				{
-					error(std::runtime_error("unknown"));
+					victim = worker;
+					victim_tasks = worker_tasks;
 				}
 			}
+
+			if (victim)
+				return (queue.steal(victim->getTaskQueue()) > 0);
 		}
 	}
 
-	try
-	{
-		m_task->onUpdate(*this);
-	}
-	catch (std::exception& e)
-	{
-		error(e);
-	}
-	catch (...)
+	// tasks are started outside the lock as onStart might add new tasks
+	for (auto& task : tasks)
 	{
-		error(std::runtime_error("unknown"));
+		queue.push(TaskDataPtr(new TaskData(
+			&thread, std::move(task.task), task.id, 0, std::move(task.mailbox), m_task_counters)));
 	}
 
-	m_timer.reset();
+	return !tasks.empty();
 }
 
-void gg::TaskData::stateChange(IThread::State old_state, IThread::State new_state)
+bool gg::TaskScheduler::handOver(Thread& thread)
 {
-	m_task->onStateChange(*this, old_state, new_state);
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	Thread* sibling = getLeastBusyWorker(&thread);
+	if (!sibling)
+		return false;
+
+	while (sibling->getTaskQueue().steal(thread.getTaskQueue()) > 0);
+	sibling->wake();
+	return true;
 }
 
-void gg::TaskData::error(std::exception& e)
+void gg::TaskScheduler::setIdle(bool idle)
 {
-	try
-	{
-		m_task->onError(*this, e);
-	}
-	catch (...)
+	if (idle)
+		++m_idle_count;
+	else
+		--m_idle_count;
+}
+
+void gg::TaskScheduler::wakeIdleWorker(const Thread& busy)
+{
+	// busy workers call it after every round of their tasks, so it's lock-free while nobody is idle
+	if (m_idle_count.load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	// the woken up worker steals in fetchTasks()
+	Thread* sibling = getLeastBusyWorker(&busy);
+	if (sibling && sibling->getTaskQueue().size() == 0)
+		sibling->wake();
+}
+
+gg::Thread* gg::TaskScheduler::getLeastBusyWorker(const Thread* except) const
+{
+	Thread* least_busy = nullptr;
+	size_t least_tasks = 0;
+
+	for (Thread* worker : m_workers)
 	{
-		finish();
+		if (worker == except)
+			continue;
+
+		size_t worker_tasks = worker->getTaskQueue().size();
+		if (!least_busy || worker_tasks < least_tasks)
+		{
+			least_busy = worker;
+			least_tasks = worker_tasks;
+		}
 	}
+
+	return least_busy;
 }
 
 
-gg::Thread::Thread(const std::string& name) :
+gg::Thread::Thread(const std::string& name, const ThreadOptions& options) :
 	m_name(name),
+	m_options(options),
 	m_thread_id(std::this_thread::get_id()),
+	m_mode(Mode::REMOTE),
 	m_running(false),
-	m_zombie(false),
-	m_switch_active(1)
+	m_state(0),
+	m_wakeup(false),
+	m_switch_active(1),
+	m_iterations(0),
+	m_idle_time_us(0),
+	m_event_count(0),
+	m_max_event_queue_depth(0),
+	m_options_applied(true)
 {
-	m_state.push_back(0);
-
-	m_tasks[0].reserve(10);
-	m_tasks[1].reserve(10);
-	m_pending_tasks.reserve(10);
-
 	m_events[0].reserve(10);
 	m_events[1].reserve(10);
-	m_pending_events.reserve(10);
+
+	m_event_quota[static_cast<size_t>(EventPriority::URGENT)].store(0);
+	m_event_quota[static_cast<size_t>(EventPriority::NORMAL)].store(0);
+	m_event_quota[static_cast<size_t>(EventPriority::BULK)].store(DEFAULT_BULK_QUOTA);
+
+	m_pending_events[static_cast<size_t>(EventPriority::NORMAL)].setLimit(options.event_queue_limit, options.event_overflow);
+	m_pending_events[static_cast<size_t>(EventPriority::BULK)].setLimit(options.event_queue_limit, options.event_overflow);
 }
 
 gg::Thread::~Thread()
@@ -233,79 +1118,152 @@ const std::string& gg::Thread::getName() const
 
 gg::IThread::State gg::Thread::getState() const
 {
-	std::lock_guard<decltype(m_state_mutex)> guard(m_state_mutex);
-	return m_state.front();
+	return m_state.load();
 }
 
 void gg::Thread::setState(State state)
 {
-	std::lock_guard<decltype(m_state_mutex)> guard(m_state_mutex);
-
 	if (m_running)
 	{
-		if (m_state.back() != state)
-			m_state.push_back(state);
+		m_pending_states.push(state);
+		wake();
+	}
+	else
+	{
+		m_state.store(state);
+	}
+}
+
+void gg::Thread::sendEvent(EventPtr event, EventPriority priority)
+{
+	if (!event)
+		return;
+
+	// local events of the other lanes are queued too, so urgent events don't wait behind them
+	if (priority == EventPriority::NORMAL && m_thread_id == std::this_thread::get_id())
+	{
+		m_events[(m_switch_active + 1) % 2].push_back(std::move(event));
+	}
+	else
+	{
+		m_pending_events[static_cast<size_t>(priority)].push(std::move(event), m_thread_id != std::this_thread::get_id());
+		wake();
+	}
+}
+
+void gg::Thread::sendEvents(const std::vector<EventPtr>& events, EventPriority priority)
+{
+	if (std::find(events.begin(), events.end(), nullptr) != events.end())
+	{
+		std::vector<EventPtr> valid_events;
+		std::copy_if(events.begin(), events.end(), std::back_inserter(valid_events), [](const EventPtr& event) { return !!event; });
+		sendEvents(valid_events, priority);
+		return;
+	}
 
-		if (m_zombie)
-			m_awake.notify_all();
+	if (events.empty())
+		return;
+
+	if (priority == EventPriority::NORMAL && m_thread_id == std::this_thread::get_id())
+	{
+		auto& next_events = m_events[(m_switch_active + 1) % 2];
+		next_events.insert(next_events.end(), events.begin(), events.end());
 	}
 	else
 	{
-		m_state.clear();
-		m_state.push_back(state);
+		m_pending_events[static_cast<size_t>(priority)].push(events.data(), events.size(), m_thread_id != std::this_thread::get_id());
+		wake();
 	}
 }
 
-void gg::Thread::sendEvent(EventPtr event)
+void gg::Thread::sendEventDelayed(EventPtr event, uint32_t delay_ms)
 {
 	if (!event)
 		return;
 
 	if (m_thread_id == std::this_thread::get_id())
 	{
-		m_events[(m_switch_active + 1) % 2].push_back(event);
+		m_delayed_events.schedule(std::move(event), getTime(), delay_ms);
 	}
 	else
 	{
-		std::lock_guard<decltype(m_events_mutex)> guard(m_events_mutex);
-		m_pending_events.push_back(event);
+		m_pending_delayed_events.push(DelayedEvent{ std::move(event), getTime(), delay_ms });
+		wake(); // the thread has to recalculate how long it can sleep
 	}
 }
 
+void gg::Thread::post(std::function<void()> func)
+{
+	if (!func)
+		return;
+
+	m_pending_calls.push(std::move(func));
+	wake();
+}
+
+void gg::Thread::addCoroutine(CoroutineFunc func, State state, size_t stack_size)
+{
+	addTask(TaskPtr(new CoroutineTask(std::move(func), stack_size)), state);
+}
+
+void gg::Thread::setEventRecorder(EventRecorderPtr recorder)
+{
+	post([this, recorder] { m_recorder = recorder; });
+}
+
+void gg::Thread::setEventQuota(EventPriority priority, size_t max_events)
+{
+	if (priority == EventPriority::URGENT || priority == EventPriority::COUNT)
+		return;
+
+	m_event_quota[static_cast<size_t>(priority)].store(max_events, std::memory_order_relaxed);
+}
+
 void gg::Thread::addTask(TaskPtr&& task, State state)
 {
 	if (m_thread_id == std::this_thread::get_id())
 	{
-		m_tasks[(m_switch_active + 1) % 2].emplace_back(
-			this, std::move(task), m_task_id_generator.next(), state);
+		m_new_tasks.emplace_back(new TaskData(
+			this, std::move(task), m_task_id_generator.next(), state, &m_subscription_index, m_task_counters));
 	}
 	else
 	{
-		std::lock_guard<decltype(m_tasks_mutex)> guard(m_tasks_mutex);
-		m_pending_tasks.push_back(TaskWithState{ std::move(task), state });
-
-		if (m_zombie)
-			m_awake.notify_all();
+		m_pending_tasks.push(TaskWithState{ std::move(task), state });
 	}
+
+	// the new task has to be considered before the thread goes to sleep
+	wake();
 }
 
 void gg::Thread::finish()
 {
-	std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
-	m_finish.thread = true;
+	{
+		std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
+		m_finish.thread = true;
+	}
+
+	wake();
 }
 
 void gg::Thread::finishTasks()
 {
-	std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
-	m_finish.all_tasks = true;
+	{
+		std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
+		m_finish.all_tasks = true;
+	}
+
+	wake();
 }
 
 void gg::Thread::finishTasksInState(State state)
 {
-	std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
-	m_finish.state_tasks = true;
-	m_finish.state = state;
+	{
+		std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
+		m_finish.state_tasks = true;
+		m_finish.state = state;
+	}
+
+	wake();
 }
 
 bool gg::Thread::run(Mode mode)
@@ -313,16 +1271,31 @@ bool gg::Thread::run(Mode mode)
 	if (m_running.exchange(true))
 		return false;
 
+	m_mode = mode;
+
+	for (auto& lane : m_pending_events)
+		lane.open();
+
 	switch (mode)
 	{
 	case Mode::LOCAL:
 		m_thread_id = std::this_thread::get_id();
-		thread();
+		{
+			// the caller gets its own affinity and priority back once the thread is done
+			ScopedThreadOptions options(m_options);
+			m_options_applied = options.isApplied();
+			thread();
+		}
 		return true;
 
 	case Mode::REMOTE:
-		m_thread = std::move(std::thread(&Thread::thread, this));
-		m_thread_id = m_thread.get_id();
+		if (!m_thread.start(std::bind(&Thread::thread, this), m_options))
+		{
+			m_running.store(false);
+			return false;
+		}
+		m_thread_id = m_thread.getID();
+		m_options_applied = m_thread.areOptionsApplied();
 		return true;
 
 	default:
@@ -336,159 +1309,234 @@ void gg::Thread::thread()
 	State prev_state;
 	bool state_will_change;
 	unsigned task_run_count;
+	unsigned task_alive_count;
+	uint32_t wait_ms;
 
 restart_thread:
-	m_zombie.store(false);
-
 	do
 	{
-		// update current state
+		// move to the next state in the queue (a state change per iteration, repeated states are skipped)
 		{
-			std::lock_guard<decltype(m_state_mutex)> guard(m_state_mutex);
-
 			prev_state = state;
-			state = m_state.front();
-			state_will_change = false;
 
-			// if there are states waiting, move the first one to the front
-			if (m_state.size() > 1)
+			State next_state;
+			while (m_pending_states.pop(next_state))
 			{
-				m_state.erase(m_state.begin());
-
-				// keep the thread running if there is still at least one state in the queue
-				if (m_state.size() > 1)
-					state_will_change = true;
+				if (next_state != state)
+				{
+					state = next_state;
+					m_state.store(state);
+					break;
+				}
 			}
+
+			// keep the thread running if there is still at least one state in the queue
+			state_will_change = !m_pending_states.empty();
 		}
 
-		// switch between tasks/next_tasks and events/next_events
+		// switch between events/next_events
 		m_switch_active = (m_switch_active + 1) % 2;
-		std::vector<TaskData>& tasks = m_tasks[m_switch_active];
-		std::vector<TaskData>& next_tasks = m_tasks[(m_switch_active + 1) % 2];
 		std::vector<EventPtr>& events = m_events[m_switch_active];
 		std::vector<EventPtr>& next_events = m_events[(m_switch_active + 1) % 2];
 
-		// add pending tasks to task list
+		// add pending tasks to the new tasks
+		{
+			TaskWithState task;
+			while (m_pending_tasks.pop(task))
+			{
+				m_new_tasks.emplace_back(new TaskData(
+					this, std::move(task.task), m_task_id_generator.next(), task.state, &m_subscription_index, m_task_counters));
+			}
+		}
+
+		// check for finish conditions
 		{
-			std::lock_guard<decltype(m_tasks_mutex)> guard(m_tasks_mutex);
+			std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
+
+			if (m_finish.all_tasks)
+			{
+				m_finish.all_tasks = false;
+
+				m_tasks.clear();
+				m_new_tasks.clear();
+
+				// pool tasks are not bound to this thread, let the siblings finish them
+				auto scheduler = getScheduler();
+				if (!scheduler || !scheduler->handOver(*this))
+					m_task_queue.clear();
+
+				break;
+			}
+
+			if (m_finish.state_tasks)
+			{
+				m_finish.state_tasks = false;
+
+				State finished_state = m_finish.state;
+				m_tasks.erase(finished_state);
+				m_new_tasks.erase(std::remove_if(m_new_tasks.begin(), m_new_tasks.end(),
+					[finished_state](const TaskDataPtr& task) { return task->getState() == finished_state; }), m_new_tasks.end());
+			}
 
-			for (auto& task : m_pending_tasks)
+			if (m_finish.thread)
 			{
-				tasks.emplace_back(
-					this, std::move(task.task), m_task_id_generator.next(), task.state);
+				m_finish.thread = false;
+
+				auto scheduler = getScheduler();
+				if (scheduler)
+					scheduler->handOver(*this);
+
+				// senders waiting for room would never be released
+				for (auto& lane : m_pending_events)
+					lane.close();
+
+				m_running.store(false);
+				return;
 			}
-			m_pending_tasks.clear();
 		}
 
-		// check for finish conditions
+		// add pending events to event list (lanes over their quota are drained in the next iterations)
+		bool events_left = popPendingEvents(events);
+
+		// add delayed events which are due
 		{
-			std::lock_guard<decltype(m_finish_mutex)> guard(m_finish_mutex);
+			uint64_t now = getTime();
 
-			if (m_finish.all_tasks)
-			{
-				m_finish.all_tasks = false;
+			DelayedEvent delayed;
+			while (m_pending_delayed_events.pop(delayed))
+				m_delayed_events.schedule(std::move(delayed.event), delayed.send_time, delayed.delay_ms);
 
-				tasks.clear();
-				next_tasks.clear();
+			m_delayed_events.advance(now, events);
+		}
 
-				break;
-			}
+		if (m_recorder && !events.empty())
+			m_recorder->record(events);
 
-			if (m_finish.state_tasks)
-			{
-				m_finish.state_tasks = false;
+		// only the subscribers of an event get it in their inbox
+		m_subscription_index.dispatch(events, state);
+
+		// run posted callables (calls posted meanwhile are left for the next iteration)
+		{
+			std::function<void()> call;
+			while (m_pending_calls.pop(call))
+				m_calls.push_back(std::move(call));
 
-				for (auto it = tasks.begin(); it != tasks.end(); )
+			for (auto& c : m_calls)
+			{
+				try
 				{
-					if (it->getState() == m_finish.state)
-						tasks.erase(it);
-					else
-						++it;
+					c();
 				}
-
-				for (auto it = next_tasks.begin(); it != next_tasks.end(); )
+				catch (...)
 				{
-					if (it->getState() == m_finish.state)
-						next_tasks.erase(it);
-					else
-						++it;
 				}
 			}
+			m_calls.clear();
+		}
 
-			if (m_finish.thread)
+		m_iterations.fetch_add(1, std::memory_order_relaxed);
+		m_event_count.fetch_add(events.size(), std::memory_order_relaxed);
+		storeMax(m_max_event_queue_depth, events.size());
+
+		wait_ms = UINT32_MAX; // time until the next task update is due
+		task_run_count = runPoolTasks(wait_ms);
+		task_alive_count = task_run_count; // pool tasks that are not finished yet
+
+		for (auto& task : m_new_tasks)
+			m_tasks[task->getState()].push_back(std::move(task));
+		m_new_tasks.clear();
+
+		auto& tasks = m_tasks[state];
+		size_t unnotified_count = tasks.size(); // tasks moved here from the previous state are already notified
+
+		// tasks of the other states are left alone, except the ones the thread just left
+		if (state != prev_state)
+		{
+			auto it = m_tasks.find(prev_state);
+			if (it != m_tasks.end())
 			{
-				m_finish.thread = false;
+				for (auto& task : it->second)
+					task->stateChange(prev_state, state);
 
-				m_running.store(false);
-				return;
+				moveTasks(it->second, prev_state);
 			}
 		}
 
-		// add pending events to event list
+		size_t alive = 0;
+		for (size_t i = 0; i < tasks.size(); ++i)
 		{
-			std::lock_guard<decltype(m_events_mutex)> guard(m_events_mutex);
+			auto& task = tasks[i];
 
-			events.insert(events.end(),
-				std::make_move_iterator(m_pending_events.begin()),
-				std::make_move_iterator(m_pending_events.end()));
-			m_pending_tasks.clear();
-		}
+			// thread just changed state
+			if (state != prev_state && i < unnotified_count)
+				task->stateChange(prev_state, state);
 
-		task_run_count = 0;
-		if (!tasks.empty())
-		{
-			for (auto& task : tasks)
+			// the task might have changed its own state in the callback
+			if (task->getState() == state)
 			{
-				// thread just changed state
-				if (state != prev_state)
-				{
-					State task_state = task.getState();
+				// update task, exceptions are handled internally
+				task->update();
 
-					// check if task got activated or deactivated and fire callback
-					if (task_state == state || task_state == prev_state)
-					{
-						task.stateChange(prev_state, state);
-					}
-				}
+				++task_run_count;
 
-				// check again if task state matches thread state and..
-				if (task.getState() != state)
+				if (task->isFinished())
 				{
-					// ..skip it now but try running it next time
-					next_tasks.push_back(std::move(task));
+					task.reset();
 					continue;
 				}
+			}
 
-				// update task, exceptions are handled internally
-				task.update(events);
+			if (task->getState() != state)
+			{
+				task->clearEvents();
+				m_tasks[task->getState()].push_back(std::move(task));
+				continue;
+			}
 
-				++task_run_count;
+			// run the task next time too
+			wait_ms = std::min(wait_ms, task->getTimeToUpdate());
+			++task_alive_count;
 
-				// run the task next time too if it's not finished
-				if (!task.isFinished())
-					next_tasks.push_back(std::move(task));
-			}
-			tasks.clear(); // clear after the run, we'll switch to next_tasks soon
+			if (alive != i)
+				tasks[alive] = std::move(task);
+			++alive;
 		}
+		tasks.resize(alive);
 
 		events.clear();
-		std::this_thread::yield();
+
+		// wake up for the next delayed event too
+		wait_ms = std::min(wait_ms, m_delayed_events.getTimeToNext(getTime()));
+
+		// sleep if none of the tasks wants to be updated continuously
+		if (state_will_change || wait_ms == 0 || events_left || !next_events.empty() || !m_new_tasks.empty())
+			std::this_thread::yield();
+		else if (task_alive_count)
+			park(wait_ms);
 
 	} while (task_run_count || state_will_change);
 
 	// enter zombie (waiting) state if no task to run on REMOTE mode
 	if (m_mode == Mode::REMOTE)
 	{
-		m_zombie.store(true);
+		// idle pool workers are woken up by busy siblings to steal their tasks
+		auto scheduler = getScheduler();
+		if (scheduler)
+			scheduler->setIdle(true);
+
+		park(UINT32_MAX);
 
-		std::unique_lock<decltype(m_awake_mutex)> l(m_awake_mutex);
-		m_awake.wait(l);
+		if (scheduler)
+			scheduler->setIdle(false);
 
 		goto restart_thread;
 	}
 	// in LOCAL mode, just exit the function
 	else
 	{
+		for (auto& lane : m_pending_events)
+			lane.close();
+
 		m_running.store(false);
 		return;
 	}
@@ -505,24 +1553,179 @@ void gg::Thread::join()
 		m_thread.join();
 }
 
+gg::ThreadMetrics gg::Thread::getMetrics() const
+{
+	ThreadMetrics metrics;
+	metrics.iterations = m_iterations.load(std::memory_order_relaxed);
+	metrics.idle_time_us = m_idle_time_us.load(std::memory_order_relaxed);
+	metrics.event_count = m_event_count.load(std::memory_order_relaxed);
+	metrics.max_event_queue_depth = m_max_event_queue_depth.load(std::memory_order_relaxed);
+	for (auto& lane : m_pending_events)
+	{
+		metrics.dropped_events += lane.getDroppedCount();
+		metrics.coalesced_events += lane.getCoalescedCount();
+	}
+	metrics.tasks = m_task_counters.getMetrics();
+	metrics.options_applied = m_options_applied;
+	return metrics;
+}
 
-gg::ThreadPool::ThreadPool()
+gg::TaskQueue& gg::Thread::getTaskQueue()
 {
+	return m_task_queue;
 }
 
-gg::ThreadPool::~ThreadPool()
+void gg::Thread::setScheduler(TaskSchedulerPtr scheduler)
 {
+	std::lock_guard<decltype(m_scheduler_mutex)> guard(m_scheduler_mutex);
+	m_scheduler = scheduler;
 }
 
-gg::ThreadPtr gg::ThreadPool::createAndAddThread(const std::string& name)
+void gg::Thread::leaveScheduler(const TaskScheduler* scheduler)
 {
-	ThreadPtr thread(new Thread(name));
+	std::lock_guard<decltype(m_scheduler_mutex)> guard(m_scheduler_mutex);
 
+	// the thread might have been added to another pool since then
+	if (m_scheduler.lock().get() == scheduler)
+		m_scheduler.reset();
+}
+
+void gg::Thread::wake()
+{
+	// only the first signal since the thread last woke up needs to notify,
+	// the lock makes sure it can't slip in between the check and the wait
+	if (!m_wakeup.exchange(true))
 	{
-		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
-		m_threads[name] = thread;
+		std::lock_guard<decltype(m_awake_mutex)> guard(m_awake_mutex);
+		m_awake.notify_all();
+	}
+}
+
+void gg::Thread::moveTasks(std::vector<TaskDataPtr>& tasks, State state)
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < tasks.size(); ++i)
+	{
+		if (tasks[i]->getState() != state)
+		{
+			tasks[i]->clearEvents();
+			m_tasks[tasks[i]->getState()].push_back(std::move(tasks[i]));
+		}
+		else
+		{
+			if (kept != i)
+				tasks[kept] = std::move(tasks[i]);
+			++kept;
+		}
+	}
+	tasks.resize(kept);
+}
+
+bool gg::Thread::popPendingEvents(std::vector<EventPtr>& events)
+{
+	bool events_left = false;
+
+	// urgent events go before the local events which are already in the list
+	m_pending_events[static_cast<size_t>(EventPriority::URGENT)].pop(m_urgent_events, 0);
+
+	if (!m_urgent_events.empty())
+	{
+		events.insert(events.begin(), std::make_move_iterator(m_urgent_events.begin()), std::make_move_iterator(m_urgent_events.end()));
+		m_urgent_events.clear();
+	}
+
+	for (auto priority : { EventPriority::NORMAL, EventPriority::BULK })
+	{
+		auto& lane = m_pending_events[static_cast<size_t>(priority)];
+		size_t quota = m_event_quota[static_cast<size_t>(priority)].load(std::memory_order_relaxed);
+
+		// a lane which didn't reach its quota is drained
+		if (lane.pop(events, quota) == quota && !lane.empty())
+			events_left = true;
+	}
+
+	return events_left;
+}
+
+void gg::Thread::park(uint32_t timeout_ms)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	std::unique_lock<decltype(m_awake_mutex)> l(m_awake_mutex);
+	auto woken_up = [this] { return m_wakeup.load(); };
+
+	if (timeout_ms == UINT32_MAX)
+		m_awake.wait(l, woken_up);
+	else
+		m_awake.wait_for(l, std::chrono::milliseconds(timeout_ms), woken_up);
+
+	m_wakeup.store(false);
+	m_idle_time_us.fetch_add(getElapsedUs(start_time), std::memory_order_relaxed);
+}
+
+uint64_t gg::Thread::getTime() const
+{
+	return m_clock.peekElapsed();
+}
+
+gg::TaskSchedulerPtr gg::Thread::getScheduler() const
+{
+	std::lock_guard<decltype(m_scheduler_mutex)> guard(m_scheduler_mutex);
+	return m_scheduler.lock();
+}
+
+unsigned gg::Thread::runPoolTasks(uint32_t& wait_ms)
+{
+	auto scheduler = getScheduler();
+	if (scheduler)
+		scheduler->fetchTasks(*this);
+
+	unsigned run_count = 0;
+
+	// update each task once, the rest of the queue can be stolen meanwhile
+	for (size_t n = m_task_queue.size(); n > 0; --n)
+	{
+		TaskDataPtr task = m_task_queue.pop();
+		if (!task)
+			break;
+
+		task->setThread(this);
+		task->update();
+
+		++run_count;
+
+		if (!task->isFinished())
+		{
+			wait_ms = std::min(wait_ms, task->getTimeToUpdate());
+			m_task_queue.push(std::move(task));
+		}
+		else
+		{
+			--run_count;
+		}
 	}
 
+	if (scheduler && m_task_queue.size() >= TaskScheduler::MIN_SHARED_TASKS)
+		scheduler->wakeIdleWorker(*this);
+
+	return run_count;
+}
+
+
+gg::ThreadPool::ThreadPool() :
+	m_thread_list(new std::vector<ThreadPtr>()),
+	m_scheduler(new TaskScheduler())
+{
+}
+
+gg::ThreadPool::~ThreadPool()
+{
+	removeThreads();
+}
+
+gg::ThreadPtr gg::ThreadPool::createAndAddThread(const std::string& name, const ThreadOptions& options)
+{
+	ThreadPtr thread(new Thread(name, options));
+	addThread(thread);
 	return thread;
 }
 
@@ -540,26 +1743,260 @@ gg::ThreadPtr gg::ThreadPool::getThread(const std::string& name) const
 void gg::ThreadPool::addThread(ThreadPtr thread)
 {
 	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
-	m_threads[thread->getName()] = thread;
+
+	auto& slot = m_threads[thread->getName()];
+	if (slot)
+		detach(slot);
+
+	slot = thread;
+	attach(thread);
+	updateThreadList();
 }
 
 bool gg::ThreadPool::removeThread(const std::string& name)
 {
 	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
-	return (m_threads.erase(name) == 1);
+
+	auto it = m_threads.find(name);
+	if (it == m_threads.end())
+		return false;
+
+	detach(it->second);
+	m_threads.erase(it);
+	updateThreadList();
+	return true;
 }
 
 void gg::ThreadPool::removeThreads()
 {
 	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	for (auto& it : m_threads)
+		detach(it.second);
+
 	m_threads.clear();
+	updateThreadList();
 }
 
-void gg::ThreadPool::sendEvent(EventPtr event)
+void gg::ThreadPool::sendEvent(EventPtr event, EventPriority priority)
 {
-	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	auto threads = getThreadList();
+	for (auto& thread : *threads)
+		thread->sendEvent(event, priority);
+
+	m_scheduler->sendEvent(std::move(event));
+}
+
+void gg::ThreadPool::sendEvents(const std::vector<EventPtr>& events, EventPriority priority)
+{
+	auto threads = getThreadList();
+	for (auto& thread : *threads)
+		thread->sendEvents(events, priority);
+
+	m_scheduler->sendEvents(events.data(), events.size());
+}
+
+void gg::ThreadPool::addTask(TaskPtr&& task)
+{
+	m_scheduler->addTask(std::move(task));
+}
+
+std::vector<gg::TaskMetrics> gg::ThreadPool::getTaskMetrics() const
+{
+	return m_scheduler->getTaskMetrics();
+}
+
+void gg::ThreadPool::attach(ThreadPtr thread)
+{
+	// only our own thread implementation can take part in work-stealing
+	auto worker = std::dynamic_pointer_cast<Thread>(thread);
+	if (worker)
+	{
+		worker->setScheduler(m_scheduler);
+		m_scheduler->addWorker(worker.get());
+	}
+}
+
+void gg::ThreadPool::updateThreadList()
+{
+	std::shared_ptr<std::vector<ThreadPtr>> threads(new std::vector<ThreadPtr>());
+	threads->reserve(m_threads.size());
+
 	for (auto& it : m_threads)
-		it.second->sendEvent(event);
+		threads->push_back(it.second);
+
+	m_thread_list = std::move(threads);
+}
+
+gg::ThreadPool::ThreadListPtr gg::ThreadPool::getThreadList() const
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+	return m_thread_list;
+}
+
+void gg::ThreadPool::detach(ThreadPtr thread)
+{
+	auto worker = std::dynamic_pointer_cast<Thread>(thread);
+	if (worker)
+	{
+		m_scheduler->removeWorker(worker.get());
+		worker->leaveScheduler(m_scheduler.get());
+	}
+}
+
+
+gg::WorkerPool::WorkerPool() :
+	m_worker_count(std::max(1u, std::thread::hardware_concurrency()) - 1),
+	m_stop(false)
+{
+	// the thread waiting for a task group helps running the jobs
+	for (unsigned i = 0; i < m_worker_count; ++i)
+		m_threads.emplace_back(&WorkerPool::worker, this);
+}
+
+gg::WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+		m_stop = true;
+	}
+
+	m_job_added.notify_all();
+
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+unsigned gg::WorkerPool::getWorkerCount() const
+{
+	return m_worker_count;
+}
+
+void gg::WorkerPool::push(std::function<void()> job)
+{
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+
+	m_job_added.notify_one();
+}
+
+bool gg::WorkerPool::runOne()
+{
+	std::function<void()> job;
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+		if (m_jobs.empty())
+			return false;
+
+		job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+	}
+
+	job();
+	return true;
+}
+
+void gg::WorkerPool::worker()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<decltype(m_mutex)> l(m_mutex);
+			m_job_added.wait(l, [this] { return (m_stop || !m_jobs.empty()); });
+
+			if (m_jobs.empty())
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		job();
+	}
+}
+
+
+gg::TaskGroup::TaskGroup(WorkerPool& workers) :
+	m_workers(workers),
+	m_pending_jobs(0)
+{
+}
+
+gg::TaskGroup::~TaskGroup()
+{
+	// jobs refer to the group, so it can't go away before them
+	try
+	{
+		wait();
+	}
+	catch (...)
+	{
+	}
+}
+
+void gg::TaskGroup::run(std::function<void()> func)
+{
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+		++m_pending_jobs;
+	}
+
+	m_workers.push([this, func = std::move(func)]
+	{
+		try
+		{
+			func();
+			jobDone(nullptr);
+		}
+		catch (...)
+		{
+			jobDone(std::current_exception());
+		}
+	});
+}
+
+void gg::TaskGroup::wait()
+{
+	for (;;)
+	{
+		{
+			std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+			if (m_pending_jobs == 0)
+				break;
+		}
+
+		// help with the queued jobs (even if they belong to other groups), then
+		// sleep only if all of our remaining jobs are being run by other threads
+		if (!m_workers.runOne())
+		{
+			std::unique_lock<decltype(m_mutex)> l(m_mutex);
+			m_job_done.wait(l, [this] { return (m_pending_jobs == 0); });
+			break;
+		}
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+		std::swap(error, m_error);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void gg::TaskGroup::jobDone(std::exception_ptr error)
+{
+	std::lock_guard<decltype(m_mutex)> guard(m_mutex);
+
+	if (error && !m_error)
+		m_error = error;
+
+	if (--m_pending_jobs == 0)
+		m_job_done.notify_all();
 }
 
 
@@ -572,9 +2009,9 @@ gg::ThreadManager::~ThreadManager()
 {
 }
 
-gg::ThreadPtr gg::ThreadManager::createThread(const std::string& name) const
+gg::ThreadPtr gg::ThreadManager::createThread(const std::string& name, const ThreadOptions& options) const
 {
-	return ThreadPtr(new Thread(name));
+	return ThreadPtr(new Thread(name, options));
 }
 
 gg::ThreadPoolPtr gg::ThreadManager::createThreadPool() const
@@ -586,3 +2023,34 @@ gg::ThreadPoolPtr gg::ThreadManager::getDefaultThreadPool()
 {
 	return m_default_thread_pool;
 }
+
+gg::TaskGroupPtr gg::ThreadManager::createTaskGroup()
+{
+	return TaskGroupPtr(new TaskGroup(getWorkers()));
+}
+
+unsigned gg::ThreadManager::getWorkerCount() const
+{
+	return const_cast<ThreadManager*>(this)->getWorkers().getWorkerCount();
+}
+
+gg::EventRecorderPtr gg::ThreadManager::createEventRecorder(const std::string& file) const
+{
+	std::shared_ptr<EventRecorder> recorder(new EventRecorder(file));
+	if (recorder->isOpen())
+		return recorder;
+	else
+		return {};
+}
+
+gg::TaskPtr gg::ThreadManager::createEventReplayer(const std::string& file, ThreadPtr target,
+	std::vector<const IEventDefinitionBase*> definitions, double speed) const
+{
+	return TaskPtr(new EventReplayer(file, target, std::move(definitions), speed));
+}
+
+gg::WorkerPool& gg::ThreadManager::getWorkers()
+{
+	std::call_once(m_workers_started, [this] { m_workers.reset(new WorkerPool()); });
+	return *m_workers;
+}
@@ -10,25 +10,147 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <map>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include "gg/thread.hpp"
 #include "gg/idgenerator.hpp"
 #include "gg/timer.hpp"
+#include "eventqueue.hpp"
+#include "eventtypes.hpp"
+#include "fiber.hpp"
+#include "mpscqueue.hpp"
+#include "nativethread.hpp"
+#include "timerwheel.hpp"
 
 namespace gg
 {
+	class Thread;
+	class TaskData;
+
+	class SubscriptionIndex // event type -> subscribed tasks of a thread, kept by the state of the tasks
+	{
+	public:
+		SubscriptionIndex();
+		~SubscriptionIndex();
+		void add(IEvent::Type, TaskData*);
+		void remove(IEvent::Type, TaskData*);
+		void move(const std::vector<IEvent::Type>&, TaskData*, IThread::State old_state, IThread::State new_state);
+		void dispatch(const std::vector<EventPtr>&, IThread::State); // to the tasks in the given state
+
+	private:
+		typedef std::vector<std::vector<TaskData*>> Subscribers; // indexed by the ID of the event type
+
+		std::unordered_map<IThread::State, Subscribers> m_subscribers;
+		size_t m_subscription_count;
+
+		void add(Subscribers&, IEvent::Type, TaskData*);
+		void remove(Subscribers&, IEvent::Type, TaskData*);
+	};
+
+	class TaskMailbox;
+
+	class MailboxIndex // event type -> mailboxes of the pool tasks subscribed to it
+	{
+	public:
+		MailboxIndex();
+		~MailboxIndex();
+		void add(IEvent::Type, TaskMailbox*);
+		void remove(IEvent::Type, TaskMailbox*);
+		void dispatch(const EventPtr* events, size_t count, std::vector<IThread*>& owners); // collects the owners of the mailboxes that got events
+
+	private:
+		typedef std::vector<std::vector<TaskMailbox*>> Mailboxes; // indexed by the ID of the event type
+
+		std::mutex m_mutex;
+		Mailboxes m_mailboxes;
+	};
+
+	typedef std::shared_ptr<MailboxIndex> MailboxIndexPtr;
+
+	class TaskMailbox // event inbox of a pool task, filled by ThreadPool::sendEvent
+	{
+	public:
+		TaskMailbox(MailboxIndexPtr);
+		~TaskMailbox();
+		void subscribe(IEvent::Type);
+		void unsubscribe(IEvent::Type);
+		bool push(const EventPtr&); // returns false if the task has already finished
+		void takeEvents(std::vector<EventPtr>&);
+		void close();
+		void setOwner(IThread*); // the worker currently running the task
+		IThread* getOwner() const;
+
+	private:
+		MailboxIndexPtr m_index;
+		mutable std::mutex m_mutex;
+		std::vector<IEvent::Type> m_subscriptions;
+		std::vector<EventPtr> m_events;
+		std::atomic<IThread*> m_owner;
+		bool m_closed;
+	};
+
+	typedef std::shared_ptr<TaskMailbox> TaskMailboxPtr;
+
+	class TaskCounters // written only by the thread running the task, read by anyone
+	{
+	public:
+		TaskCounters(ITask::ID, std::string name);
+		void addUpdate(uint64_t time_us);
+		void addEvent(uint64_t time_us);
+		void addError();
+		TaskMetrics getMetrics() const;
+
+	private:
+		ITask::ID m_task_id;
+		std::string m_name;
+		std::atomic<uint64_t> m_update_count;
+		std::atomic<uint64_t> m_update_time_us;
+		std::atomic<uint64_t> m_max_update_time_us;
+		std::atomic<uint64_t> m_event_count;
+		std::atomic<uint64_t> m_event_time_us;
+		std::atomic<uint64_t> m_max_event_time_us;
+		std::atomic<uint64_t> m_error_count;
+	};
+
+	typedef std::shared_ptr<TaskCounters> TaskCountersPtr;
+
+	class TaskCountersList // tasks drop out of the list once their counters are released
+	{
+	public:
+		TaskCountersList();
+		~TaskCountersList();
+		void add(TaskCountersPtr);
+		std::vector<TaskMetrics> getMetrics() const;
+
+	private:
+		mutable std::mutex m_mutex;
+		std::vector<std::weak_ptr<TaskCounters>> m_counters;
+		size_t m_prune_size;
+	};
+
 	class TaskData : public ITaskOptions
 	{
 	public:
-		TaskData(IThread*, TaskPtr, ITask::ID, IThread::State);
-		TaskData(TaskData&&);
+		// regular tasks register their subscriptions in the thread's index,
+		// pool tasks in their own mailbox
+		TaskData(IThread*, TaskPtr, ITask::ID, IThread::State, SubscriptionIndex*, TaskCountersList&);
+		TaskData(IThread*, TaskPtr, ITask::ID, IThread::State, TaskMailboxPtr, TaskCountersList&);
+		TaskData(const TaskData&) = delete;
 		virtual ~TaskData();
-		TaskData& operator=(TaskData&&);
+		TaskData& operator=(const TaskData&) = delete;
 		bool isFinished() const;
 		bool isSubscribed(IEvent::Type) const;
-		void update(const std::vector<EventPtr>&);
+		uint32_t getTimeToUpdate() const; // UINT32_MAX: waits for events
+		void setThread(IThread*);
+		void pushEvent(const EventPtr&);
+		void clearEvents();
+		void update();
 		void stateChange(IThread::State old_state, IThread::State new_state);
 		void error(std::exception&);
 
@@ -43,6 +165,8 @@ namespace gg
 		virtual void unsubscribe(IEventDefinitionBase&);
 		virtual uint32_t getElapsedMs() const;
 		virtual void finish();
+		virtual void setUpdateInterval(uint32_t ms);
+		virtual void setEventDriven(bool);
 
 	private:
 		IThread* m_thread;
@@ -50,19 +174,131 @@ namespace gg
 		ITask::ID m_task_id;
 		IThread::State m_task_state;
 		std::vector<IEvent::Type> m_subscriptions;
+		std::vector<EventPtr> m_events;
 		Timer m_timer;
+		uint32_t m_update_interval;
+		bool m_event_driven;
 		bool m_finished;
+		SubscriptionIndex* m_index;
+		TaskMailboxPtr m_mailbox;
+		TaskCountersPtr m_counters;
+
+		void start(TaskCountersList&);
+		bool isUpdateDue(bool got_events) const;
 	};
 
+	typedef std::unique_ptr<TaskData> TaskDataPtr;
+
+	class CoroutineTask : public ITask, public ICoroutine
+	{
+	public:
+		CoroutineTask(CoroutineFunc, size_t stack_size);
+		virtual ~CoroutineTask();
+
+		// inherited from ITask
+		virtual void onStart(ITaskOptions&);
+		virtual void onEvent(ITaskOptions&, EventPtr);
+		virtual void onUpdate(ITaskOptions&);
+
+		// inherited from ICoroutine
+		virtual ITaskOptions& getOptions();
+		virtual EventPtr waitEvent(IEvent::Type);
+		virtual EventPtr waitEvent(IEventDefinitionBase&);
+		virtual void sleep(uint32_t ms);
+		virtual void waitUntil(std::function<bool()> condition, uint32_t poll_ms, uint32_t max_poll_ms);
+
+	private:
+		enum Wait
+		{
+			NONE,
+			EVENT,
+			SLEEP,
+			CONDITION
+		};
+
+		ITaskOptions* m_options;
+		Wait m_wait;
+		IEvent::Type m_event_type;
+		std::deque<EventPtr> m_events;
+		std::chrono::steady_clock::time_point m_wake_time;
+		std::function<bool()> m_condition;
+		uint32_t m_poll_ms;
+		uint32_t m_max_poll_ms;
+		Fiber m_fiber; // destroyed first, it might unwind a suspended stack
+
+		bool isReady();
+		EventPtr takeEvent(IEvent::Type);
+		void suspend(Wait, uint32_t update_interval);
+	};
+
+	class TaskQueue // per-thread deque of pool tasks
+	{
+	public:
+		TaskQueue();
+		~TaskQueue();
+		size_t size() const;
+		void push(TaskDataPtr);
+		TaskDataPtr pop();
+		size_t steal(TaskQueue& victim); // moves half of the victim's tasks to this queue
+		void clear();
+
+	private:
+		mutable std::mutex m_mutex;
+		std::deque<TaskDataPtr> m_tasks;
+	};
+
+	class TaskScheduler // work-stealing state shared by the threads of a pool
+	{
+	public:
+		enum : size_t { MIN_SHARED_TASKS = 2 }; // a worker with this many tasks wakes up an idle sibling to steal
+
+		TaskScheduler();
+		~TaskScheduler();
+		void addWorker(Thread*);
+		void removeWorker(Thread*);
+		void addTask(TaskPtr&&);
+		void sendEvent(EventPtr);
+		void sendEvents(const EventPtr* events, size_t count);
+		std::vector<TaskMetrics> getTaskMetrics() const;
+		bool fetchTasks(Thread&); // adopts pending tasks or steals from siblings
+		bool handOver(Thread&); // moves the thread's pool tasks to its siblings
+		void setIdle(bool); // the worker is parked until woken up
+		void wakeIdleWorker(const Thread& busy);
+
+	private:
+		struct PendingTask
+		{
+			TaskPtr task;
+			ITask::ID id;
+			TaskMailboxPtr mailbox;
+		};
+
+		mutable std::mutex m_mutex;
+		std::mutex m_wake_mutex; // m_workers changes under both locks, so either is enough to read it
+		std::vector<Thread*> m_workers;
+		std::vector<PendingTask> m_pending_tasks;
+		std::atomic<size_t> m_pending_count;
+		std::atomic<size_t> m_idle_count;
+		MailboxIndexPtr m_mailboxes;
+		gg::IDGenerator<ITask::ID> m_task_id_generator;
+		TaskCountersList m_task_counters;
+
+		Thread* getLeastBusyWorker(const Thread* except = nullptr) const;
+	};
+
+	typedef std::shared_ptr<TaskScheduler> TaskSchedulerPtr;
+
 	class Thread : public IThread
 	{
 	public:
-		Thread(const std::string& name);
+		Thread(const std::string& name, const ThreadOptions& = {});
 		virtual ~Thread();
 		virtual const std::string& getName() const;
 		virtual State getState() const;
 		virtual void setState(State);
-		virtual void sendEvent(EventPtr);
+		virtual void sendEvent(EventPtr, EventPriority);
+		virtual void sendEvents(const std::vector<EventPtr>&, EventPriority);
+		virtual void sendEventDelayed(EventPtr, uint32_t delay_ms);
 		virtual void addTask(TaskPtr&&, State);
 		virtual void finish();
 		virtual void finishTasks();
@@ -70,14 +306,35 @@ namespace gg
 		virtual bool run(Mode = Mode::REMOTE);
 		virtual bool isAlive() const;
 		virtual void join();
+		virtual ThreadMetrics getMetrics() const;
+		virtual void post(std::function<void()>);
+		virtual void addCoroutine(CoroutineFunc, State, size_t stack_size);
+		virtual void setEventRecorder(EventRecorderPtr);
+		virtual void setEventQuota(EventPriority, size_t max_events);
+
+		// for internal use (work-stealing), a thread takes part in the
+		// work-stealing of the last pool it was added to
+		TaskQueue& getTaskQueue();
+		void setScheduler(TaskSchedulerPtr);
+		void leaveScheduler(const TaskScheduler*);
+		void wake();
 
 	private:
+		enum : size_t { DEFAULT_BULK_QUOTA = 1000 }; // bulk events dispatched in an iteration
+
 		struct TaskWithState
 		{
 			TaskPtr task;
 			State state;
 		};
 
+		struct DelayedEvent
+		{
+			EventPtr event;
+			uint64_t send_time;
+			uint32_t delay_ms;
+		};
+
 		struct Finish
 		{
 			bool thread = false;
@@ -87,26 +344,50 @@ namespace gg
 		};
 
 		std::string m_name;
-		std::thread m_thread;
+		ThreadOptions m_options;
+		NativeThread m_thread;
 		std::thread::id m_thread_id;
 		Mode m_mode;
 		std::atomic<bool> m_running;
-		std::atomic<bool> m_zombie;
-		mutable std::mutex m_state_mutex;
-		std::vector<State> m_state;
+		std::atomic<State> m_state; // current state
+		MPSCQueue<State> m_pending_states; // set by setState(), applied one per iteration
 		mutable std::mutex m_finish_mutex;
 		volatile Finish m_finish;
 		mutable std::mutex m_awake_mutex;
 		std::condition_variable m_awake;
+		std::atomic<bool> m_wakeup;
 		gg::IDGenerator<ITask::ID> m_task_id_generator;
 		unsigned m_switch_active;
-		mutable std::mutex m_tasks_mutex;
-		std::vector<TaskData> m_tasks[2];
-		std::vector<TaskWithState> m_pending_tasks;
-		mutable std::mutex m_events_mutex;
+		SubscriptionIndex m_subscription_index; // has to outlive m_tasks
+		std::unordered_map<State, std::vector<TaskDataPtr>> m_tasks; // tasks by state, only the current state is iterated
+		std::vector<TaskDataPtr> m_new_tasks; // added since the last iteration, sorted in by the next one
+		MPSCQueue<TaskWithState> m_pending_tasks; // tasks added by other threads
 		std::vector<EventPtr> m_events[2];
-		std::vector<EventPtr> m_pending_events;
+		EventQueue m_pending_events[static_cast<size_t>(EventPriority::COUNT)]; // lanes of events sent by other threads
+		std::atomic<size_t> m_event_quota[static_cast<size_t>(EventPriority::COUNT)];
+		std::vector<EventPtr> m_urgent_events;
+		MPSCQueue<DelayedEvent> m_pending_delayed_events;
+		TimerWheel<EventPtr> m_delayed_events;
+		MPSCQueue<std::function<void()>> m_pending_calls; // posted callables
+		std::vector<std::function<void()>> m_calls;
+		EventRecorderPtr m_recorder; // only accessed by the thread
+		Timer m_clock;
+		mutable std::mutex m_scheduler_mutex;
+		std::weak_ptr<TaskScheduler> m_scheduler;
+		TaskQueue m_task_queue;
+		TaskCountersList m_task_counters;
+		std::atomic<uint64_t> m_iterations;
+		std::atomic<uint64_t> m_idle_time_us;
+		std::atomic<uint64_t> m_event_count;
+		std::atomic<uint64_t> m_max_event_queue_depth;
+		std::atomic<bool> m_options_applied; // see ThreadMetrics::options_applied
 
+		uint64_t getTime() const; // ms since the thread was created
+		TaskSchedulerPtr getScheduler() const;
+		unsigned runPoolTasks(uint32_t& wait_ms);
+		void moveTasks(std::vector<TaskDataPtr>& tasks, State state); // tasks not in 'state' go to their own list
+		bool popPendingEvents(std::vector<EventPtr>& events); // returns true if events are left in the lanes
+		void park(uint32_t timeout_ms); // UINT32_MAX: until woken up
 		void thread();
 	};
 
@@ -115,16 +396,66 @@ namespace gg
 	public:
 		ThreadPool();
 		virtual ~ThreadPool();
-		virtual ThreadPtr createAndAddThread(const std::string& name);
+		virtual ThreadPtr createAndAddThread(const std::string& name, const ThreadOptions&);
 		virtual ThreadPtr getThread(const std::string& name) const;
 		virtual void addThread(ThreadPtr);
 		virtual bool removeThread(const std::string& name);
 		virtual void removeThreads();
-		virtual void sendEvent(EventPtr);
+		virtual void sendEvent(EventPtr, EventPriority);
+		virtual void sendEvents(const std::vector<EventPtr>&, EventPriority);
+		virtual void addTask(TaskPtr&&);
+		virtual std::vector<TaskMetrics> getTaskMetrics() const;
 
 	private:
+		typedef std::shared_ptr<const std::vector<ThreadPtr>> ThreadListPtr;
+
 		mutable std::mutex m_mutex;
 		std::map<std::string, ThreadPtr> m_threads;
+		ThreadListPtr m_thread_list; // immutable copy of m_threads, events are sent without holding the mutex
+		TaskSchedulerPtr m_scheduler;
+
+		void attach(ThreadPtr);
+		void detach(ThreadPtr);
+		void updateThreadList();
+		ThreadListPtr getThreadList() const;
+	};
+
+	class WorkerPool // anonymous threads running the jobs of task groups
+	{
+	public:
+		WorkerPool();
+		~WorkerPool();
+		unsigned getWorkerCount() const;
+		void push(std::function<void()>);
+		bool runOne(); // runs a queued job on the calling thread, returns false if there was none
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_job_added;
+		std::deque<std::function<void()>> m_jobs;
+		std::vector<std::thread> m_threads;
+		unsigned m_worker_count;
+		bool m_stop;
+
+		void worker();
+	};
+
+	class TaskGroup : public ITaskGroup
+	{
+	public:
+		TaskGroup(WorkerPool&);
+		virtual ~TaskGroup();
+		virtual void run(std::function<void()>);
+		virtual void wait();
+
+	private:
+		WorkerPool& m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_job_done;
+		size_t m_pending_jobs;
+		std::exception_ptr m_error;
+
+		void jobDone(std::exception_ptr);
 	};
 
 	class ThreadManager : public IThreadManager
@@ -132,11 +463,20 @@ namespace gg
 	public:
 		ThreadManager();
 		virtual ~ThreadManager();
-		virtual ThreadPtr createThread(const std::string& name) const;
+		virtual ThreadPtr createThread(const std::string& name, const ThreadOptions&) const;
 		virtual ThreadPoolPtr createThreadPool() const;
 		virtual ThreadPoolPtr getDefaultThreadPool();
+		virtual TaskGroupPtr createTaskGroup();
+		virtual unsigned getWorkerCount() const;
+		virtual EventRecorderPtr createEventRecorder(const std::string& file) const;
+		virtual TaskPtr createEventReplayer(const std::string& file, ThreadPtr target,
+			std::vector<const IEventDefinitionBase*> definitions, double speed) const;
 
 	private:
 		ThreadPoolPtr m_default_thread_pool;
+		std::unique_ptr<WorkerPool> m_workers; // started on first use
+		std::once_flag m_workers_started;
+
+		WorkerPool& getWorkers();
 	};
 };
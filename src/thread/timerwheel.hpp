@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+/**
+ * Hierarchical timer wheel with 1 ms ticks. The first level holds timers
+ * due in the next 256 ticks, each further level covers 256 times the range
+ * of the previous one. Timers of the upper levels are moved down (cascaded)
+ * when the lower level wraps around, so scheduling and expiring a timer is
+ * O(1) regardless of the number of pending timers.
+ *
+ * Not thread-safe, the wheel is owned and advanced by a single thread.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace gg
+{
+	template<class T>
+	class TimerWheel
+	{
+	public:
+		TimerWheel() :
+			m_now(0),
+			m_count(0)
+		{
+		}
+
+		size_t size() const
+		{
+			return m_count;
+		}
+
+		// 'now' is the current time in ms, it is the same clock advance() gets
+		void schedule(T value, uint64_t now, uint32_t delay_ms)
+		{
+			// the wheel might lag behind if it wasn't advanced for a while
+			uint64_t due = now + delay_ms;
+			if (due <= m_now)
+				due = m_now + 1;
+
+			insert(Entry{ due, std::move(value) });
+			++m_count;
+		}
+
+		// moves the values of the expired timers to 'expired'
+		void advance(uint64_t now, std::vector<T>& expired)
+		{
+			if (m_count == 0)
+			{
+				if (now > m_now)
+					m_now = now;
+				return;
+			}
+
+			while (m_now < now)
+			{
+				++m_now;
+
+				// cascade the upper levels when the lower level wraps around
+				for (unsigned level = 1; level < LEVELS && (m_now & mask(level - 1)) == 0; ++level)
+				{
+					std::vector<Entry> timers;
+					timers.swap(m_slots[level][slot(m_now, level)]);
+					for (auto& timer : timers)
+						insert(std::move(timer));
+				}
+
+				auto& timers = m_slots[0][slot(m_now, 0)];
+				for (auto& timer : timers)
+					expired.push_back(std::move(timer.value));
+				m_count -= timers.size();
+				timers.clear();
+
+				if (m_count == 0)
+				{
+					m_now = now;
+					break;
+				}
+			}
+		}
+
+		// returns the time until the wheel has to be advanced next (UINT32_MAX if empty),
+		// timers on the upper levels might make it return earlier than their deadline
+		uint32_t getTimeToNext(uint64_t now) const
+		{
+			if (m_count == 0)
+				return UINT32_MAX;
+
+			// a cascade of an upper level can bring timers before the first one of the lower level
+			uint64_t next = UINT64_MAX;
+
+			for (unsigned level = 0; level < LEVELS; ++level)
+			{
+				uint64_t base = (m_now >> (SLOT_BITS * level)) + 1;
+
+				for (uint64_t tick = base; tick < base + SLOTS; ++tick)
+				{
+					if (!m_slots[level][tick & (SLOTS - 1)].empty())
+					{
+						next = std::min(next, tick << (SLOT_BITS * level));
+						break;
+					}
+				}
+			}
+
+			if (next <= now)
+				return 0;
+
+			return (uint32_t)std::min<uint64_t>(next - now, UINT32_MAX - 1);
+		}
+
+	private:
+		enum : unsigned
+		{
+			SLOT_BITS = 8,
+			SLOTS = 1 << SLOT_BITS,
+			LEVELS = 4
+		};
+
+		struct Entry
+		{
+			uint64_t due;
+			T value;
+		};
+
+		static uint64_t mask(unsigned level)
+		{
+			return ((uint64_t)1 << (SLOT_BITS * (level + 1))) - 1;
+		}
+
+		static size_t slot(uint64_t due, unsigned level)
+		{
+			return (size_t)((due >> (SLOT_BITS * level)) & (SLOTS - 1));
+		}
+
+		void insert(Entry&& timer)
+		{
+			uint64_t delta = timer.due - m_now;
+			unsigned level = 0;
+
+			// pick the lowest level which doesn't wrap around before the deadline
+			while (level < LEVELS - 1 && delta > mask(level))
+				++level;
+
+			// timers beyond the range of the wheel wait in the farthest slot and get re-cascaded
+			uint64_t due = (delta > mask(LEVELS - 1)) ? m_now + mask(LEVELS - 1) : timer.due;
+
+			m_slots[level][slot(due, level)].push_back(std::move(timer));
+		}
+
+		uint64_t m_now; // last tick processed
+		size_t m_count;
+		std::vector<Entry> m_slots[LEVELS][SLOTS];
+	};
+};
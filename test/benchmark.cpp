@@ -0,0 +1,600 @@
+/**
+ * Copyright (c) 2014-2016 Gbor Grzsny (www.gorzsony.com)
+ *
+ * This source is a private work and can be used only with the
+ * written permission of the author. Do not redistribute it!
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "gg/event.hpp"
+#include "gg/logger.hpp"
+#include "gg/network.hpp"
+#include "gg/thread.hpp"
+
+using namespace gg::literals;
+
+GG_LOCAL_EVENT(bench_event, "bench", int);
+
+class Stopwatch
+{
+public:
+	Stopwatch() :
+		m_start(std::chrono::high_resolution_clock::now())
+	{
+	}
+
+	double getElapsedSec() const
+	{
+		auto elapsed = std::chrono::high_resolution_clock::now() - m_start;
+		return std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point m_start;
+};
+
+class CounterTask : public gg::ITask
+{
+public:
+	CounterTask(std::atomic<size_t>* counter) :
+		m_counter(counter)
+	{
+	}
+
+	virtual ~CounterTask() = default;
+
+	virtual void onStart(gg::ITaskOptions& options)
+	{
+		options.subscribe(bench_event);
+		options.setEventDriven(true);
+	}
+
+	virtual void onEvent(gg::ITaskOptions&, gg::EventPtr)
+	{
+		m_counter->fetch_add(1, std::memory_order_relaxed);
+	}
+
+	virtual void onUpdate(gg::ITaskOptions&)
+	{
+	}
+
+private:
+	std::atomic<size_t>* m_counter;
+};
+
+static void waitFor(const std::atomic<size_t>& counter, size_t value)
+{
+	while (counter.load() < value)
+		std::this_thread::yield();
+}
+
+// N producer threads -> gg::Thread::sendEvent -> one consumer thread
+static void benchmarkEventInbox(unsigned producers, size_t events_per_producer)
+{
+	std::atomic<size_t> counter(0);
+
+	auto consumer = gg::threadmgr.createThread("consumer");
+	consumer->addTask<CounterTask>(&counter);
+	consumer->run();
+
+	auto event = bench_event(1); // the same event is sent to measure the inbox only
+	std::vector<std::thread> threads;
+	Stopwatch stopwatch;
+
+	for (unsigned i = 0; i < producers; ++i)
+	{
+		threads.emplace_back([&]
+		{
+			for (size_t n = 0; n < events_per_producer; ++n)
+				consumer->sendEvent(event);
+		});
+	}
+
+	for (auto& t : threads)
+		t.join();
+
+	waitFor(counter, producers * events_per_producer);
+	double elapsed = stopwatch.getElapsedSec();
+
+	consumer->finish();
+	consumer->join();
+
+	gg::log << "event inbox: " << producers << " producer(s), "
+		<< static_cast<size_t>(producers * events_per_producer / elapsed) << " events/s" << std::endl;
+}
+
+// same as above, but the producers send batches of events with sendEvents()
+static void benchmarkEventInboxBatched(unsigned producers, size_t events_per_producer, size_t batch_size)
+{
+	std::atomic<size_t> counter(0);
+
+	auto consumer = gg::threadmgr.createThread("consumer");
+	consumer->addTask<CounterTask>(&counter);
+	consumer->run();
+
+	std::vector<gg::EventPtr> batch(batch_size, bench_event(1));
+	std::vector<std::thread> threads;
+	Stopwatch stopwatch;
+
+	for (unsigned i = 0; i < producers; ++i)
+	{
+		threads.emplace_back([&]
+		{
+			for (size_t n = 0; n < events_per_producer; n += batch_size)
+				consumer->sendEvents(batch);
+		});
+	}
+
+	for (auto& t : threads)
+		t.join();
+
+	waitFor(counter, producers * events_per_producer);
+	double elapsed = stopwatch.getElapsedSec();
+
+	consumer->finish();
+	consumer->join();
+
+	gg::log << "event inbox: " << producers << " producer(s), batches of " << batch_size << ", "
+		<< static_cast<size_t>(producers * events_per_producer / elapsed) << " events/s" << std::endl;
+}
+
+// every event is created by the producer and destroyed by the consumer
+static void benchmarkEventDispatch(unsigned producers, size_t events_per_producer)
+{
+	std::atomic<size_t> counter(0);
+
+	auto consumer = gg::threadmgr.createThread("consumer");
+	consumer->addTask<CounterTask>(&counter);
+	consumer->run();
+
+	std::vector<std::thread> threads;
+	Stopwatch stopwatch;
+
+	for (unsigned i = 0; i < producers; ++i)
+	{
+		threads.emplace_back([&]
+		{
+			for (size_t n = 0; n < events_per_producer; ++n)
+				consumer->sendEvent(bench_event(static_cast<int>(n)));
+		});
+	}
+
+	for (auto& t : threads)
+		t.join();
+
+	waitFor(counter, producers * events_per_producer);
+	double elapsed = stopwatch.getElapsedSec();
+
+	consumer->finish();
+	consumer->join();
+
+	gg::log << "event create+dispatch: " << producers << " producer(s), "
+		<< static_cast<size_t>(producers * events_per_producer / elapsed) << " events/s" << std::endl;
+}
+
+// pooled events vs. a separate heap allocation for the event and its control block
+static void benchmarkEventCreation(size_t events)
+{
+	typedef gg::LocalEventDefinition<"bench"_event, int>::Event Event;
+	const size_t batch = 1000; // keep a few events alive like a busy inbox would
+	std::vector<gg::EventPtr> alive;
+	alive.reserve(batch);
+
+	Stopwatch pooled_stopwatch;
+	for (size_t n = 0; n < events; ++n)
+	{
+		alive.push_back(bench_event(static_cast<int>(n)));
+		if (alive.size() == batch)
+			alive.clear();
+	}
+	double pooled_elapsed = pooled_stopwatch.getElapsedSec();
+	alive.clear();
+
+	Stopwatch heap_stopwatch;
+	for (size_t n = 0; n < events; ++n)
+	{
+		alive.push_back(gg::EventPtr(new Event(static_cast<int>(n))));
+		if (alive.size() == batch)
+			alive.clear();
+	}
+	double heap_elapsed = heap_stopwatch.getElapsedSec();
+	alive.clear();
+
+	gg::log << "event creation: pooled " << static_cast<size_t>(events / pooled_elapsed)
+		<< " events/s, new " << static_cast<size_t>(events / heap_elapsed) << " events/s" << std::endl;
+}
+
+// updated continuously, gets the events sent to the thread too
+class UpdateCounterTask : public gg::ITask
+{
+public:
+	UpdateCounterTask(std::atomic<size_t>* counter) :
+		m_counter(counter)
+	{
+	}
+
+	virtual ~UpdateCounterTask() = default;
+
+	virtual void onStart(gg::ITaskOptions& options)
+	{
+		options.subscribe(bench_event);
+	}
+
+	virtual void onEvent(gg::ITaskOptions&, gg::EventPtr)
+	{
+	}
+
+	virtual void onUpdate(gg::ITaskOptions&)
+	{
+		m_counter->fetch_add(1, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<size_t>* m_counter;
+};
+
+// tasks spread over states, only the tasks of the current state are updated
+static void benchmarkStateTasks(size_t tasks, gg::IThread::State states, size_t iterations_per_state)
+{
+	std::atomic<size_t> counter(0);
+
+	auto consumer = gg::threadmgr.createThread("consumer");
+	for (size_t n = 0; n < tasks; ++n)
+		consumer->addTask(gg::TaskPtr(new UpdateCounterTask(&counter)), static_cast<gg::IThread::State>(n % states));
+	consumer->run();
+
+	size_t tasks_per_state = tasks / states;
+	auto event = bench_event(1);
+	Stopwatch stopwatch;
+
+	for (gg::IThread::State state = 0; state < states; ++state)
+	{
+		consumer->setState(state);
+
+		size_t start = counter.load();
+		while (counter.load() < start + iterations_per_state * tasks_per_state)
+		{
+			consumer->sendEvent(event);
+			std::this_thread::yield();
+		}
+	}
+
+	double elapsed = stopwatch.getElapsedSec();
+
+	consumer->finish();
+	consumer->join();
+
+	gg::log << "state tasks: " << tasks << " tasks in " << states << " states, "
+		<< static_cast<size_t>(counter.load() / elapsed) << " task updates/s" << std::endl;
+}
+
+// loopback connections accepted as fast as a client thread opens them
+static void benchmarkAccept(uint16_t port, size_t connections)
+{
+	auto server = gg::net.createServer(port);
+	if (!server->start())
+	{
+		gg::log << "accept: couldn't start server" << std::endl;
+		return;
+	}
+
+	std::atomic<bool> done(false);
+	Stopwatch stopwatch;
+
+	std::thread client([&]
+	{
+		for (size_t n = 0; n < connections; ++n)
+		{
+			auto connection = gg::net.createConnection("127.0.0.1", port);
+			connection->connect();
+		}
+
+		done = true;
+	});
+
+	size_t accepted = 0;
+	while (accepted < connections)
+	{
+		if (server->getNextConnection(100))
+			++accepted;
+		else if (done)
+			break;
+	}
+
+	double elapsed = stopwatch.getElapsedSec();
+
+	client.join();
+	server->stop();
+
+	gg::log << "accept: " << static_cast<size_t>(accepted / elapsed) << " connections/s ("
+		<< accepted << " of " << connections << ")" << std::endl;
+}
+
+// one client streams the same packet to the server over loopback
+static void benchmarkPackets(uint16_t port, size_t packets)
+{
+	auto server = gg::net.createServer(port);
+	auto client = gg::net.createConnection("127.0.0.1", port);
+	if (!server->start() || !client->connect())
+	{
+		gg::log << "packets: couldn't connect" << std::endl;
+		return;
+	}
+
+	auto connection = server->getNextConnection(1000);
+	if (!connection)
+	{
+		gg::log << "packets: couldn't accept" << std::endl;
+		return;
+	}
+
+	Stopwatch stopwatch;
+
+	std::thread sender([&]
+	{
+		auto packet = client->createPacket(bench_event(1));
+		for (size_t n = 0; n < packets; ++n)
+			client->send(packet);
+	});
+
+	size_t received = 0;
+	while (received < packets && connection->isAlive())
+	{
+		if (connection->getNextPacket(100))
+			++received;
+	}
+
+	double elapsed = stopwatch.getElapsedSec();
+
+	sender.join();
+	client->disconnect();
+	server->stop();
+
+	gg::log << "packets: " << static_cast<size_t>(received / elapsed) << " packets/s ("
+		<< received << " of " << packets << ")" << std::endl;
+}
+
+static void benchmarkThroughput(uint16_t port, size_t message_size, size_t messages)
+{
+	auto server = gg::net.createServer(port);
+	auto client = gg::net.createConnection("127.0.0.1", port);
+	if (!server->start() || !client->connect())
+	{
+		gg::log << "throughput: couldn't connect" << std::endl;
+		return;
+	}
+
+	auto connection = server->getNextConnection(1000);
+	if (!connection)
+	{
+		gg::log << "throughput: couldn't accept" << std::endl;
+		return;
+	}
+
+	Stopwatch stopwatch;
+
+	std::thread sender([&]
+	{
+		std::string payload(message_size, 'x');
+		auto packet = client->createPacket(bench_event.getType());
+		packet->write(payload.data(), payload.size());
+
+		for (size_t n = 0; n < messages; ++n)
+			client->send(packet);
+
+		client->flush(1000);
+	});
+
+	std::vector<gg::PacketPtr> packets;
+	size_t received = 0;
+	while (received < messages && connection->isAlive())
+	{
+		packets.clear();
+		received += connection->getNextPackets(packets, 1000, 100);
+	}
+
+	double elapsed = stopwatch.getElapsedSec();
+
+	sender.join();
+	client->disconnect();
+	server->stop();
+
+	gg::log << "throughput (" << message_size << " bytes): " << static_cast<size_t>(received / elapsed) << " packets/s, "
+		<< static_cast<size_t>(received * message_size / elapsed / (1024 * 1024)) << " MiB/s ("
+		<< received << " of " << messages << ")" << std::endl;
+}
+
+// packets are created and serialized while a batch of them stays alive
+static void benchmarkPacketCreation(size_t packets, size_t payload_size)
+{
+	const size_t batch = 1000;
+	std::string payload(payload_size, 'x');
+	std::vector<gg::PacketPtr> alive;
+	alive.reserve(batch);
+
+	Stopwatch stopwatch;
+	for (size_t n = 0; n < packets; ++n)
+	{
+		auto packet = gg::net.createPacket(bench_event.getType());
+		packet->write(payload.data(), payload.size());
+		alive.push_back(std::move(packet));
+		if (alive.size() == batch)
+			alive.clear();
+	}
+	double elapsed = stopwatch.getElapsedSec();
+
+	gg::log << "packet creation (" << payload_size << " bytes): " << static_cast<size_t>(packets / elapsed) << " packets/s" << std::endl;
+}
+
+// packets of the last connection are received while the others stay idle, either by polling
+// every connection or by a reactor waiting for all of them at once
+static void benchmarkIdleConnections(uint16_t port, size_t idle_connections, size_t packets, bool use_reactor)
+{
+	auto server = gg::net.createServer(port);
+	if (!server->start())
+	{
+		gg::log << "idle connections: couldn't start the server" << std::endl;
+		return;
+	}
+
+	std::vector<gg::ConnectionPtr> clients;
+	std::vector<gg::ConnectionPtr> connections;
+	for (size_t n = 0; n <= idle_connections; ++n)
+	{
+		auto client = gg::net.createConnection("127.0.0.1", port);
+		auto connection = client->connect() ? server->getNextConnection(1000) : gg::ConnectionPtr();
+		if (!connection)
+		{
+			gg::log << "idle connections: couldn't connect" << std::endl;
+			return;
+		}
+
+		clients.push_back(client);
+		connections.push_back(connection);
+	}
+
+	size_t received = 0;
+	auto reactor = gg::net.createReactor();
+	reactor->setPacketHandler([&](gg::ConnectionPtr, gg::PacketPtr) { ++received; });
+	if (use_reactor)
+	{
+		for (auto& connection : connections)
+			reactor->addConnection(connection);
+	}
+
+	Stopwatch stopwatch;
+
+	std::thread sender([&]
+	{
+		auto& client = clients.back();
+		auto packet = client->createPacket(bench_event(1));
+		for (size_t n = 0; n < packets; ++n)
+			client->send(packet);
+	});
+
+	while (received < packets && connections.back()->isAlive())
+	{
+		if (use_reactor)
+		{
+			reactor->poll(100);
+		}
+		else
+		{
+			for (auto& connection : connections)
+			{
+				if (connection->getNextPacket(0))
+					++received;
+			}
+		}
+	}
+
+	double elapsed = stopwatch.getElapsedSec();
+
+	sender.join();
+	server->stop();
+
+	gg::log << "idle connections (" << idle_connections << ", " << (use_reactor ? "reactor" : "polling") << "): "
+		<< static_cast<size_t>(received / elapsed) << " packets/s (" << received << " of " << packets << ")" << std::endl;
+}
+
+template<class Storage, size_t... N>
+static double sumStatic(const Storage& storage, std::index_sequence<N...>)
+{
+	double values[] = { static_cast<double>(storage.template get<N>())... };
+	double sum = 0;
+	for (double value : values)
+		sum += value;
+	return sum;
+}
+
+template<class... Types, size_t... N>
+static double sumDynamic(const gg::IStorage& storage, std::index_sequence<N...>)
+{
+	double values[] = { static_cast<double>(storage.get<Types>(N))... };
+	double sum = 0;
+	for (double value : values)
+		sum += value;
+	return sum;
+}
+
+// construction and both ways of reading the parameters of an event shape
+template<class... Types>
+static void benchmarkStorage(const char* shape, size_t iterations, Types... values)
+{
+	typedef gg::Storage<Types...> Storage;
+	const size_t count = 1024; // more than a single object to keep reads from being hoisted
+	std::unique_ptr<Storage[]> storages(new Storage[count]);
+
+	Stopwatch construct_stopwatch;
+	for (size_t n = 0; n < iterations; ++n)
+	{
+		Storage& storage = storages[n % count];
+		storage.~Storage();
+		new (&storage) Storage(values...);
+	}
+	double construct_elapsed = construct_stopwatch.getElapsedSec();
+
+	double sum = 0;
+	Stopwatch static_stopwatch;
+	for (size_t n = 0; n < iterations; ++n)
+		sum += sumStatic(storages[n % count], std::index_sequence_for<Types...>());
+	double static_elapsed = static_stopwatch.getElapsedSec();
+
+	Stopwatch dynamic_stopwatch;
+	for (size_t n = 0; n < iterations; ++n)
+		sum -= sumDynamic<Types...>(storages[n % count], std::index_sequence_for<Types...>());
+	double dynamic_elapsed = dynamic_stopwatch.getElapsedSec();
+
+	gg::log << "storage<" << shape << ">: " << Storage::SIZE << " bytes, construct "
+		<< static_cast<size_t>(iterations / construct_elapsed) << "/s, get<N> "
+		<< static_cast<size_t>(iterations / static_elapsed) << "/s, get<T>(n) "
+		<< static_cast<size_t>(iterations / dynamic_elapsed) << "/s"
+		<< (sum == 0 ? "" : " (mismatch)") << std::endl;
+}
+
+
+int main()
+{
+	const unsigned max_producers = std::max(2u, std::thread::hardware_concurrency());
+
+	for (unsigned producers = 1; producers <= max_producers; producers *= 2)
+		benchmarkEventInbox(producers, 200000);
+
+	for (unsigned producers = 1; producers <= max_producers; producers *= 2)
+		benchmarkEventInboxBatched(producers, 200000, 100);
+
+	benchmarkStorage<int>("int", 10000000, 1);
+	benchmarkStorage<int, float>("int, float", 10000000, 1, 2.f);
+	benchmarkStorage<char, double, char, int64_t>("char, double, char, int64_t", 10000000, 'a', 2.0, 'b', 4);
+	benchmarkStorage<uint8_t, uint16_t, uint32_t, uint64_t, float, double>(
+		"uint8_t, uint16_t, uint32_t, uint64_t, float, double", 10000000, 1, 2, 3, 4, 5.f, 6.0);
+
+	benchmarkEventCreation(2000000);
+
+	for (unsigned producers = 1; producers <= max_producers; producers *= 2)
+		benchmarkEventDispatch(producers, 200000);
+
+	benchmarkStateTasks(10000, 8, 1000);
+
+	benchmarkPacketCreation(2000000, 64);
+	benchmarkPacketCreation(200000, 4096);
+
+	benchmarkAccept(12350, 5000);
+	benchmarkPackets(12351, 500000);
+	benchmarkIdleConnections(12352, 500, 100000, false);
+	benchmarkIdleConnections(12353, 500, 100000, true);
+	benchmarkThroughput(12354, 64, 1000000);
+	benchmarkThroughput(12355, 4096, 200000);
+	benchmarkThroughput(12356, 1024 * 1024, 2000);
+
+	return 0;
+}
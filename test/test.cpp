@@ -27,15 +27,16 @@
 
 using namespace gg::literals;
 
-gg::SerializableEventDefinition<"foo"_event, int, float> foo_event;
+GG_SERIALIZABLE_EVENT(foo_event, "foo", int, float);
 typedef gg::IEvent::Tag<0, int> foo_param1;
 typedef gg::IEvent::Tag<1, float> foo_param2;
 
 class ConnectionTask : public gg::ITask
 {
 public:
-	ConnectionTask(gg::ConnectionPtr connection) :
-		m_connection(connection)
+	ConnectionTask(gg::ConnectionPtr connection, gg::IThreadPool* workers) :
+		m_connection(connection),
+		m_workers(workers)
 	{
 	}
 
@@ -64,7 +65,7 @@ public:
 				gg::log << "packet: length=" << packet->getSize() << ", type=" << packet->getType() << std::endl;
 
 				auto event = foo_event(*packet);
-				options.getThread().sendEvent(event); // accepts empty pointer too
+				m_workers->sendEvent(event); // accepts empty pointer too
 			}
 			else if (!m_connection->isAlive())
 			{
@@ -79,12 +80,14 @@ public:
 
 private:
 	gg::ConnectionPtr m_connection;
+	gg::IThreadPool* m_workers; // not owned, the pool outlives its tasks
 };
 
 class ServerTask : public gg::ITask
 {
 public:
-	ServerTask()
+	ServerTask(gg::ThreadPoolPtr workers) :
+		m_workers(workers)
 	{
 		m_server = gg::net.createServer(12345);
 
@@ -111,7 +114,7 @@ public:
 				if (connection)
 				{
 					gg::log << "connection: " << connection->getAddress() << std::endl;
-					options.getThread().addTask<ConnectionTask>(connection);
+					m_workers->addTask<ConnectionTask>(connection, m_workers.get());
 				}
 			}
 			else
@@ -127,6 +130,7 @@ public:
 
 private:
 	gg::ServerPtr m_server;
+	gg::ThreadPoolPtr m_workers;
 };
 
 
@@ -206,8 +210,12 @@ int main()
 	gg::log << std::endl;
 
 
+	auto workers = gg::threadmgr.createThreadPool();
+	workers->createAndAddThread("worker thread 1")->run();
+	workers->createAndAddThread("worker thread 2")->run();
+
 	auto server = gg::threadmgr.createThread("server thread");
-	server->addTask<ServerTask>();
+	server->addTask<ServerTask>(workers);
 	server->run();
 
 	auto connection = gg::net.createConnection("127.0.0.1", 12345);